@@ -0,0 +1,149 @@
+#pragma once
+
+#include "span.hh"
+#include <cerrno>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#include <unistd.h>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Double-buffered reader of a stream of trivially copyable T from a file
+//! descriptor, overlapping I/O with processing.
+//!
+//! A background thread fills one buffer with read() while the caller
+//! processes the other one:
+//!
+//!     phundrak::background_reader<float> reader{fd};
+//!     for (auto chunk = reader.next(); !chunk.empty(); chunk = reader.next())
+//!       process(chunk);
+//!
+//! A chunk stays valid until the next call to next(). Every chunk but the
+//! last one holds exactly chunk_size() elements; a trailing incomplete
+//! element is dropped. Reading stops at end of file or on the first read
+//! error, reported by error(). The file descriptor is not closed, and the
+//! destructor waits for a read() in progress to return.
+template <class T> class background_reader {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "background_reader needs trivially copyable elements");
+
+  struct buffer {
+    T *data;
+    size_type bytes; // valid bytes, once full
+    bool full;
+  };
+
+  //! Read until the buffer is full, the input ends or read() fails.
+  size_type fill(T *data, int &error) {
+    char *out = reinterpret_cast<char *>(data);
+    size_type total = 0, capacity = chunk_size_ * sizeof(T);
+    while (total < capacity) {
+      ssize_t got = ::read(fd_, out + total, capacity - total);
+      if (got > 0) {
+        total += static_cast<size_type>(got);
+      } else if (got < 0 && errno == EINTR) {
+        continue;
+      } else {
+        if (got < 0)
+          error = errno;
+        break;
+      }
+    }
+    return total;
+  }
+
+  void run() {
+    for (unsigned k = 0;; k ^= 1) {
+      {
+        std::unique_lock<std::mutex> guard{lock_};
+        ready_.wait(guard, [this, k] { return stop_ || !buffers_[k].full; });
+        if (stop_)
+          return;
+      }
+      int error = 0;
+      size_type bytes = fill(buffers_[k].data, error);
+      {
+        std::lock_guard<std::mutex> guard{lock_};
+        error_ = error;
+        buffers_[k].bytes = bytes;
+        buffers_[k].full = true;
+      }
+      ready_.notify_all();
+      if (bytes < chunk_size_ * sizeof(T))
+        return; // the input is exhausted, this was the last chunk
+    }
+  }
+
+  int fd_;
+  size_type chunk_size_;
+  buffer buffers_[2];
+  unsigned turn_; // buffer the next chunk comes from
+  bool held_;     // whether the caller holds buffers_[turn_ ^ 1]
+  bool done_;
+  bool stop_;
+  int error_;
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::thread thread_;
+
+public:
+  //! Read from fd in chunks of chunk_size elements, starting right away.
+  explicit background_reader(int fd, size_type chunk_size = (1 << 20) /
+                                                            sizeof(T))
+      : fd_{fd}, chunk_size_{chunk_size ? chunk_size : 1}, buffers_{},
+        turn_{0}, held_{false}, done_{false}, stop_{false}, error_{0},
+        lock_{}, ready_{}, thread_{} {
+    for (buffer &b : buffers_)
+      b.data = static_cast<T *>(::operator new(
+          chunk_size_ * sizeof(T), std::align_val_t{alignof(T)}));
+    thread_ = std::thread{[this] { run(); }};
+  }
+
+  background_reader(const background_reader &) = delete;
+  background_reader &operator=(const background_reader &) = delete;
+
+  ~background_reader() {
+    {
+      std::lock_guard<std::mutex> guard{lock_};
+      stop_ = true;
+    }
+    ready_.notify_all();
+    thread_.join();
+    for (buffer &b : buffers_)
+      ::operator delete(b.data, std::align_val_t{alignof(T)});
+  }
+
+  //! Give the previous chunk back and wait for the next one; an empty span
+  //! means the input is exhausted.
+  span<const T> next() {
+    std::unique_lock<std::mutex> guard{lock_};
+    if (held_) {
+      buffers_[turn_ ^ 1].full = false;
+      held_ = false;
+      ready_.notify_all();
+    }
+    if (done_)
+      return {};
+    ready_.wait(guard, [this] { return buffers_[turn_].full; });
+    const buffer &b = buffers_[turn_];
+    done_ = b.bytes < chunk_size_ * sizeof(T);
+    held_ = true;
+    turn_ ^= 1;
+    return span<const T>{b.data, b.bytes / sizeof(T)};
+  }
+
+  size_type chunk_size() const noexcept { return chunk_size_; }
+
+  //! errno of the read() that failed, or 0.
+  int error() {
+    std::lock_guard<std::mutex> guard{lock_};
+    return error_;
+  }
+};
+
+} // namespace phundrak
@@ -0,0 +1,739 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Dynamic array of bits packed in 64-bit words.
+//!
+//! Bits past size() in the last word are always kept to zero, so that count(),
+//! find_first() and comparisons can work on whole words.
+class bit_vector {
+public:
+  using word_type = std::uint64_t;
+
+  static constexpr size_type word_bits = 64;
+  static constexpr size_type npos = static_cast<size_type>(-1);
+
+  class reference;
+  class iterator;
+  class const_iterator;
+
+private:
+  static size_type words_for(size_type bits) noexcept {
+    return (bits + word_bits - 1) / word_bits;
+  }
+
+  static word_type bit_mask(size_type pos) noexcept {
+    return word_type{1} << (pos % word_bits);
+  }
+
+  static void same_size_or_die(const bit_vector &lhs, const bit_vector &rhs,
+                               const char *where) {
+    try {
+      if (lhs.size_ != rhs.size_)
+        throw std::length_error("Size mismatch");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << " in phundrak::bit_vector::" << where << ": "
+                << lhs.size_ << " and " << rhs.size_ << " bits\n";
+      std::terminate();
+    }
+  }
+
+  void reallocate(size_type new_words) {
+    word_type *olddata = words_;
+    words_ = new word_type[new_words]();
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = olddata[i];
+    delete[] olddata;
+    capacity_ = new_words;
+  }
+
+  //! Zero the bits of the last word that lie past size().
+  void clear_unused_bits() noexcept {
+    if (size_ % word_bits)
+      words_[size_ / word_bits] &= bit_mask(size_) - 1;
+  }
+
+  //! Word-wise dst = op(dst, src). A plain loop over words, which the
+  //! compiler vectorises for whatever instruction set it targets.
+  template <class Op> void apply(const bit_vector &other, Op op) noexcept {
+    word_type *dst = words_;
+    const word_type *src = other.words_;
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      dst[i] = op(dst[i], src[i]);
+  }
+
+  word_type *words_;
+  size_type size_;
+  size_type capacity_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  bit_vector() noexcept : words_{nullptr}, size_{0}, capacity_{0} {}
+
+  explicit bit_vector(size_type count, bool value = false)
+      : words_{nullptr}, size_{0}, capacity_{0} {
+    resize(count, value);
+  }
+
+  bit_vector(std::initializer_list<bool> init) : bit_vector{} {
+    reserve(init.size());
+    for (bool bit : init)
+      push_back(bit);
+  }
+
+  bit_vector(const bit_vector &other)
+      : words_{other.capacity_ ? new word_type[other.capacity_]() : nullptr},
+        size_{other.size_}, capacity_{other.capacity_} {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = other.words_[i];
+  }
+
+  bit_vector(bit_vector &&other) noexcept : bit_vector{} { swap(other); }
+
+  ~bit_vector() noexcept { delete[] words_; }
+
+  bit_vector &operator=(const bit_vector &other) {
+    bit_vector w{other};
+    swap(w);
+    return *this;
+  }
+
+  bit_vector &operator=(bit_vector &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  bool test(size_type pos) const noexcept {
+    return words_[pos / word_bits] & bit_mask(pos);
+  }
+
+  reference operator[](size_type pos) noexcept;
+  bool operator[](size_type pos) const noexcept { return test(pos); }
+
+  reference at(size_type pos);
+  bool at(size_type pos) const {
+    try {
+      if (pos >= size_)
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::bit_vector " << this << '\n';
+      std::terminate();
+    }
+    return test(pos);
+  }
+
+  reference front() noexcept;
+  bool front() const noexcept { return test(0); }
+
+  reference back() noexcept;
+  bool back() const noexcept { return test(size_ - 1); }
+
+  //! Underlying words, least significant bit first.
+  word_type *data() noexcept { return words_; }
+  const word_type *data() const noexcept { return words_; }
+  size_type num_words() const noexcept { return words_for(size_); }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  iterator begin() noexcept;
+  const_iterator begin() const noexcept;
+  const_iterator cbegin() const noexcept;
+
+  iterator end() noexcept;
+  const_iterator end() const noexcept;
+  const_iterator cend() const noexcept;
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type capacity() const noexcept { return capacity_ * word_bits; }
+
+  void reserve(size_type new_cap) {
+    size_type needed = words_for(new_cap);
+    if (needed <= capacity_)
+      return;
+    size_type new_words = capacity_ ? capacity_ : 1;
+    while (new_words < needed)
+      new_words <<= 1;
+    reallocate(new_words);
+  }
+
+  void shrink_to_fit() {
+    size_type needed = words_for(size_);
+    if (needed == capacity_)
+      return;
+    if (needed == 0) {
+      delete[] words_;
+      words_ = nullptr;
+      capacity_ = 0;
+      return;
+    }
+    reallocate(needed);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void clear() noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = 0;
+    size_ = 0;
+  }
+
+  void push_back(bool value) {
+    reserve(size_ + 1);
+    if (value)
+      words_[size_ / word_bits] |= bit_mask(size_);
+    ++size_;
+  }
+
+  void pop_back() noexcept {
+    if (size_ > 0) {
+      --size_;
+      words_[size_ / word_bits] &= ~bit_mask(size_);
+    }
+  }
+
+  void resize(size_type count, bool value = false) {
+    if (count <= size_) {
+      size_ = count;
+      for (size_type i = words_for(size_); i < capacity_; ++i)
+        words_[i] = 0;
+      if (capacity_)
+        clear_unused_bits();
+      return;
+    }
+    reserve(count);
+    if (value) {
+      // finish the partial word, then fill whole words
+      for (; size_ < count && size_ % word_bits; ++size_)
+        words_[size_ / word_bits] |= bit_mask(size_);
+      for (size_type i = words_for(size_), n = words_for(count); i < n; ++i)
+        words_[i] = ~word_type{0};
+    }
+    size_ = count;
+    clear_unused_bits();
+  }
+
+  void swap(bit_vector &other) noexcept {
+    std::swap(words_, other.words_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+  }
+
+  // Bit operations /////////////////////////////////////////////////////////
+
+  bit_vector &set(size_type pos, bool value = true) noexcept {
+    if (value)
+      words_[pos / word_bits] |= bit_mask(pos);
+    else
+      words_[pos / word_bits] &= ~bit_mask(pos);
+    return *this;
+  }
+
+  bit_vector &set() noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = ~word_type{0};
+    clear_unused_bits();
+    return *this;
+  }
+
+  bit_vector &reset(size_type pos) noexcept { return set(pos, false); }
+
+  bit_vector &reset() noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = 0;
+    return *this;
+  }
+
+  bit_vector &flip(size_type pos) noexcept {
+    words_[pos / word_bits] ^= bit_mask(pos);
+    return *this;
+  }
+
+  bit_vector &flip() noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      words_[i] = ~words_[i];
+    clear_unused_bits();
+    return *this;
+  }
+
+  //! Number of set bits.
+  size_type count() const noexcept {
+    size_type total = 0;
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      total += static_cast<size_type>(__builtin_popcountll(words_[i]));
+    return total;
+  }
+
+  bool any() const noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      if (words_[i])
+        return true;
+    return false;
+  }
+
+  bool none() const noexcept { return !any(); }
+
+  bool all() const noexcept { return count() == size_; }
+
+  //! Index of the first set bit, or npos.
+  size_type find_first() const noexcept {
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      if (words_[i])
+        return i * word_bits +
+               static_cast<size_type>(__builtin_ctzll(words_[i]));
+    return npos;
+  }
+
+  //! Index of the first set bit strictly after pos, or npos. npos itself
+  //! finds nothing rather than wrapping around to 0.
+  size_type find_next(size_type pos) const noexcept {
+    if (pos >= size_ || ++pos >= size_)
+      return npos;
+    size_type i = pos / word_bits;
+    word_type w = words_[i] & ~(bit_mask(pos) - 1);
+    const size_type n = words_for(size_);
+    while (!w) {
+      if (++i == n)
+        return npos;
+      w = words_[i];
+    }
+    return i * word_bits + static_cast<size_type>(__builtin_ctzll(w));
+  }
+
+  // Set algebra ////////////////////////////////////////////////////////////
+  // Both operands must have the same size.
+
+  bit_vector &operator&=(const bit_vector &other) {
+    same_size_or_die(*this, other, "operator&=");
+    apply(other, [](auto a, auto b) { return a & b; });
+    return *this;
+  }
+
+  bit_vector &operator|=(const bit_vector &other) {
+    same_size_or_die(*this, other, "operator|=");
+    apply(other, [](auto a, auto b) { return a | b; });
+    return *this;
+  }
+
+  bit_vector &operator^=(const bit_vector &other) {
+    same_size_or_die(*this, other, "operator^=");
+    apply(other, [](auto a, auto b) { return a ^ b; });
+    return *this;
+  }
+
+  //! this = this & ~other
+  bit_vector &andnot(const bit_vector &other) {
+    same_size_or_die(*this, other, "andnot");
+    apply(other, [](auto a, auto b) { return a & ~b; });
+    return *this;
+  }
+
+  bool operator==(const bit_vector &other) const noexcept {
+    if (size_ != other.size_)
+      return false;
+    for (size_type i = 0, n = words_for(size_); i < n; ++i)
+      if (words_[i] != other.words_[i])
+        return false;
+    return true;
+  }
+
+  bool operator!=(const bit_vector &other) const noexcept {
+    return !(*this == other);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                             Proxy reference                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  class reference {
+    word_type *word_;
+    word_type mask_;
+
+    reference(word_type *word, word_type mask) noexcept
+        : word_{word}, mask_{mask} {}
+
+  public:
+    reference(const reference &) = default;
+    ~reference() = default;
+
+    reference &operator=(bool value) noexcept {
+      if (value)
+        *word_ |= mask_;
+      else
+        *word_ &= ~mask_;
+      return *this;
+    }
+
+    reference &operator=(const reference &other) noexcept {
+      return *this = static_cast<bool>(other);
+    }
+
+    operator bool() const noexcept { return *word_ & mask_; }
+    bool operator~() const noexcept { return !(*word_ & mask_); }
+
+    reference &flip() noexcept {
+      *word_ ^= mask_;
+      return *this;
+    }
+
+    friend class bit_vector;
+  };
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                             Iterator classes                          //
+  ///////////////////////////////////////////////////////////////////////////
+
+  class const_iterator {
+  protected:
+    const bit_vector *v_;
+    size_type pos_;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = bool;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = bool;
+
+    const_iterator() noexcept : v_{nullptr}, pos_{0} {}
+    const_iterator(const bit_vector *v, size_type pos) noexcept
+        : v_{v}, pos_{pos} {}
+
+    bool operator*() const noexcept { return v_->test(pos_); }
+    bool operator[](difference_type n) const noexcept {
+      return v_->test(pos_ + static_cast<size_type>(n));
+    }
+
+    const_iterator &operator++() noexcept {
+      ++pos_;
+      return *this;
+    }
+    const_iterator operator++(int) noexcept {
+      const_iterator t{*this};
+      ++pos_;
+      return t;
+    }
+    const_iterator &operator--() noexcept {
+      --pos_;
+      return *this;
+    }
+    const_iterator operator--(int) noexcept {
+      const_iterator t{*this};
+      --pos_;
+      return t;
+    }
+    const_iterator &operator+=(difference_type n) noexcept {
+      pos_ += static_cast<size_type>(n);
+      return *this;
+    }
+    const_iterator &operator-=(difference_type n) noexcept {
+      pos_ -= static_cast<size_type>(n);
+      return *this;
+    }
+    const_iterator operator+(difference_type n) const noexcept {
+      return const_iterator{*this} += n;
+    }
+    const_iterator operator-(difference_type n) const noexcept {
+      return const_iterator{*this} -= n;
+    }
+    difference_type operator-(const const_iterator &other) const noexcept {
+      return static_cast<difference_type>(pos_) -
+             static_cast<difference_type>(other.pos_);
+    }
+
+    bool operator==(const const_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const const_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+    bool operator<(const const_iterator &o) const noexcept {
+      return pos_ < o.pos_;
+    }
+    bool operator>(const const_iterator &o) const noexcept {
+      return pos_ > o.pos_;
+    }
+    bool operator<=(const const_iterator &o) const noexcept {
+      return pos_ <= o.pos_;
+    }
+    bool operator>=(const const_iterator &o) const noexcept {
+      return pos_ >= o.pos_;
+    }
+
+    friend const_iterator operator+(difference_type n, const const_iterator &it) noexcept {
+      return it + n;
+    }
+  };
+
+  class iterator : public const_iterator {
+  public:
+    using reference = bit_vector::reference;
+
+    iterator() noexcept : const_iterator{} {}
+    iterator(bit_vector *v, size_type pos) noexcept : const_iterator{v, pos} {}
+
+    reference operator*() const noexcept {
+      return const_cast<bit_vector *>(this->v_)->operator[](this->pos_);
+    }
+    reference operator[](difference_type n) const noexcept {
+      return *(*this + n);
+    }
+
+    iterator &operator++() noexcept {
+      ++this->pos_;
+      return *this;
+    }
+    iterator operator++(int) noexcept {
+      iterator t{*this};
+      ++this->pos_;
+      return t;
+    }
+    iterator &operator--() noexcept {
+      --this->pos_;
+      return *this;
+    }
+    iterator operator--(int) noexcept {
+      iterator t{*this};
+      --this->pos_;
+      return t;
+    }
+    iterator &operator+=(difference_type n) noexcept {
+      this->pos_ += static_cast<size_type>(n);
+      return *this;
+    }
+    iterator &operator-=(difference_type n) noexcept {
+      this->pos_ -= static_cast<size_type>(n);
+      return *this;
+    }
+    iterator operator+(difference_type n) const noexcept {
+      return iterator{*this} += n;
+    }
+    iterator operator-(difference_type n) const noexcept {
+      return iterator{*this} -= n;
+    }
+    using const_iterator::operator-;
+
+    friend iterator operator+(difference_type n, const iterator &it) noexcept {
+      return it + n;
+    }
+  };
+};
+
+inline bit_vector::reference bit_vector::operator[](size_type pos) noexcept {
+  return reference{words_ + pos / word_bits, bit_mask(pos)};
+}
+
+inline bit_vector::reference bit_vector::at(size_type pos) {
+  try {
+    if (pos >= size_)
+      throw std::out_of_range("Out of range");
+  } catch (const std::out_of_range &e) {
+    std::cout << e.what() << " in phundrak::bit_vector " << this << '\n';
+    std::terminate();
+  }
+  return (*this)[pos];
+}
+
+inline bit_vector::reference bit_vector::front() noexcept {
+  return (*this)[0];
+}
+
+inline bit_vector::reference bit_vector::back() noexcept {
+  return (*this)[size_ - 1];
+}
+
+inline bit_vector::iterator bit_vector::begin() noexcept {
+  return iterator{this, 0};
+}
+inline bit_vector::const_iterator bit_vector::begin() const noexcept {
+  return const_iterator{this, 0};
+}
+inline bit_vector::const_iterator bit_vector::cbegin() const noexcept {
+  return const_iterator{this, 0};
+}
+
+inline bit_vector::iterator bit_vector::end() noexcept {
+  return iterator{this, size_};
+}
+inline bit_vector::const_iterator bit_vector::end() const noexcept {
+  return const_iterator{this, size_};
+}
+inline bit_vector::const_iterator bit_vector::cend() const noexcept {
+  return const_iterator{this, size_};
+}
+
+inline bit_vector operator&(bit_vector lhs, const bit_vector &rhs) {
+  return lhs &= rhs;
+}
+
+inline bit_vector operator|(bit_vector lhs, const bit_vector &rhs) {
+  return lhs |= rhs;
+}
+
+inline bit_vector operator^(bit_vector lhs, const bit_vector &rhs) {
+  return lhs ^= rhs;
+}
+
+inline bit_vector operator~(bit_vector v) { return v.flip(); }
+
+inline bit_vector andnot(bit_vector lhs, const bit_vector &rhs) {
+  return lhs.andnot(rhs);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                              Rank and select                              //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Constant-time rank and logarithmic-time select over a bit_vector.
+//!
+//! The structure keeps a cumulative popcount every 512 bits (one cache line of
+//! words) and refers to the bit_vector it was built from, which must outlive
+//! it and must not be modified; call build() again after any change.
+class rank_select {
+public:
+  using word_type = bit_vector::word_type;
+
+  static constexpr size_type block_words = 8;
+  static constexpr size_type block_bits = block_words * bit_vector::word_bits;
+  static constexpr size_type npos = bit_vector::npos;
+
+private:
+  static size_type select_in_word(word_type w, size_type k) noexcept {
+    // drop the k lowest set bits, then the lowest remaining one is the answer
+    for (; k; --k)
+      w &= w - 1;
+    return static_cast<size_type>(__builtin_ctzll(w));
+  }
+
+  static size_type popcount(word_type w) noexcept {
+    return static_cast<size_type>(__builtin_popcountll(w));
+  }
+
+  const bit_vector *bits_;
+  size_type *blocks_; // ones before each block, plus the grand total
+  size_type num_blocks_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  rank_select() noexcept : bits_{nullptr}, blocks_{nullptr}, num_blocks_{0} {}
+
+  explicit rank_select(const bit_vector &bits) : rank_select{} { build(bits); }
+
+  rank_select(const rank_select &) = delete;
+  rank_select &operator=(const rank_select &) = delete;
+
+  rank_select(rank_select &&other) noexcept : rank_select{} {
+    std::swap(bits_, other.bits_);
+    std::swap(blocks_, other.blocks_);
+    std::swap(num_blocks_, other.num_blocks_);
+  }
+
+  rank_select &operator=(rank_select &&other) noexcept {
+    std::swap(bits_, other.bits_);
+    std::swap(blocks_, other.blocks_);
+    std::swap(num_blocks_, other.num_blocks_);
+    return *this;
+  }
+
+  ~rank_select() noexcept { delete[] blocks_; }
+
+  void build(const bit_vector &bits) {
+    delete[] blocks_;
+    bits_ = &bits;
+    const size_type words = bits.num_words();
+    num_blocks_ = (words + block_words - 1) / block_words;
+    blocks_ = new size_type[num_blocks_ + 1];
+    size_type total = 0;
+    for (size_type b = 0; b < num_blocks_; ++b) {
+      blocks_[b] = total;
+      for (size_type i = b * block_words;
+           i < words && i < (b + 1) * block_words; ++i)
+        total += popcount(bits.data()[i]);
+    }
+    blocks_[num_blocks_] = total;
+  }
+
+  //! Number of set bits in [0, pos).
+  size_type rank1(size_type pos) const noexcept {
+    const word_type *w = bits_->data();
+    size_type block = pos / block_bits;
+    size_type r = blocks_[block];
+    size_type word = pos / bit_vector::word_bits;
+    for (size_type i = block * block_words; i < word; ++i)
+      r += popcount(w[i]);
+    if (pos % bit_vector::word_bits)
+      r += popcount(w[word] &
+                    ((word_type{1} << (pos % bit_vector::word_bits)) - 1));
+    return r;
+  }
+
+  //! Number of cleared bits in [0, pos).
+  size_type rank0(size_type pos) const noexcept { return pos - rank1(pos); }
+
+  //! Position of the k-th set bit (counting from zero), or npos.
+  size_type select1(size_type k) const noexcept {
+    if (k >= blocks_[num_blocks_])
+      return npos;
+    // last block whose cumulative count is <= k
+    size_type lo = 0, hi = num_blocks_;
+    while (hi - lo > 1) {
+      size_type mid = lo + (hi - lo) / 2;
+      if (blocks_[mid] <= k)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    k -= blocks_[lo];
+    const word_type *w = bits_->data();
+    size_type i = lo * block_words;
+    for (size_type c = popcount(w[i]); c <= k; c = popcount(w[++i]))
+      k -= c;
+    return i * bit_vector::word_bits + select_in_word(w[i], k);
+  }
+
+  //! Position of the k-th cleared bit (counting from zero), or npos.
+  size_type select0(size_type k) const noexcept {
+    const size_type size = bits_->size();
+    if (k >= size - blocks_[num_blocks_])
+      return npos;
+    auto zeros_before = [this](size_type b) { return b * block_bits - blocks_[b]; };
+    size_type lo = 0, hi = num_blocks_;
+    while (hi - lo > 1) {
+      size_type mid = lo + (hi - lo) / 2;
+      if (zeros_before(mid) <= k)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    k -= zeros_before(lo);
+    const word_type *w = bits_->data();
+    size_type i = lo * block_words;
+    for (size_type c = popcount(~w[i]); c <= k; c = popcount(~w[++i]))
+      k -= c;
+    return i * bit_vector::word_bits + select_in_word(~w[i], k);
+  }
+};
+
+} // namespace phundrak
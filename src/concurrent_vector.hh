@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Grow-only vector that many threads may append to at once.
+//!
+//! Storage is a fixed table of segments of geometrically growing size:
+//! segment k holds first_segment_size << k elements, so elements never move
+//! once constructed and references to them stay valid for the lifetime of
+//! the container. push_back() and grow_by() reserve their indices with one
+//! atomic fetch-add and allocate a missing segment with a compare-exchange,
+//! without any lock. operator[] is O(1): the segment is the position of the
+//! highest set bit of the index.
+//!
+//! size() counts reserved slots, some of which may still be under
+//! construction by another thread: readers should only access an index after
+//! being told about it by the thread that appended it.
+//!
+//! Every segment ends with one flag per slot, set once the element in it is
+//! constructed. If a constructor throws, its slot stays reserved and counted
+//! by size() but holds no element: built() tells, and clear(), the copy
+//! constructor and the destructor skip it.
+template <class T> class concurrent_vector {
+public:
+  static constexpr size_type first_segment_bits = 3;
+  static constexpr size_type first_segment_size = size_type{1}
+                                                  << first_segment_bits;
+  static constexpr size_type max_segments = 64 - first_segment_bits;
+
+  class const_iterator;
+
+private:
+  static size_type segment_of(size_type pos) noexcept {
+    size_type q = (pos >> first_segment_bits) + 1;
+    return 63 - static_cast<size_type>(__builtin_clzll(q));
+  }
+
+  static size_type segment_base(size_type k) noexcept {
+    return ((size_type{1} << k) - 1) << first_segment_bits;
+  }
+
+  static size_type segment_size(size_type k) noexcept {
+    return first_segment_size << k;
+  }
+
+  //! Room for the elements of segment k followed by their flags, cleared.
+  static T *allocate_segment(size_type k) {
+    const size_type n = segment_size(k);
+    T *segment = static_cast<T *>(::operator new(
+        n * sizeof(T) + n, std::align_val_t{alignof(T)}));
+    std::memset(flags(segment, k), 0, n);
+    return segment;
+  }
+
+  //! Construction flags of segment k: nonzero where an element lives.
+  static unsigned char *flags(T *segment, size_type k) noexcept {
+    return reinterpret_cast<unsigned char *>(segment + segment_size(k));
+  }
+
+  static void deallocate_segment(T *segment) noexcept {
+    ::operator delete(segment, std::align_val_t{alignof(T)});
+  }
+
+  //! Segment k, allocating it if no other thread did it first.
+  T *ensure_segment(size_type k) {
+    T *segment = segments_[k].load(std::memory_order_acquire);
+    if (segment)
+      return segment;
+    T *fresh = allocate_segment(k);
+    if (segments_[k].compare_exchange_strong(segment, fresh,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_acquire))
+      return fresh;
+    deallocate_segment(fresh); // another thread won the race
+    return segment;
+  }
+
+  T *slot(size_type pos) const noexcept {
+    size_type k = segment_of(pos);
+    T *segment = segments_[k].load(std::memory_order_acquire);
+    return segment + (pos - segment_base(k));
+  }
+
+  template <class... Args>
+  size_type construct_range(size_type n, const Args &... args) {
+    size_type first = size_.fetch_add(n, std::memory_order_relaxed);
+    size_type last = first + n;
+    for (size_type pos = first; pos < last;) {
+      size_type k = segment_of(pos);
+      T *segment = ensure_segment(k);
+      unsigned char *built = flags(segment, k);
+      size_type end = segment_base(k) + segment_size(k);
+      for (; pos < last && pos < end; ++pos) {
+        size_type i = pos - segment_base(k);
+        new (segment + i) T(args...);
+        built[i] = 1;
+      }
+    }
+    return first;
+  }
+
+  void check_range(size_type pos) const {
+    try {
+      if (pos >= size())
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::concurrent_vector " << this
+                << '\n';
+      std::terminate();
+    }
+  }
+
+  std::atomic<T *> segments_[max_segments];
+  std::atomic<size_type> size_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  concurrent_vector() noexcept : segments_{}, size_{0} {}
+
+  explicit concurrent_vector(size_type count, const T &value = T())
+      : concurrent_vector{} {
+    grow_by(count, value);
+  }
+
+  concurrent_vector(std::initializer_list<T> init) : concurrent_vector{} {
+    reserve(init.size());
+    for (const T &elem : init)
+      push_back(elem);
+  }
+
+  //! Not safe against concurrent appends to other. Slots whose construction
+  //! failed are left out.
+  concurrent_vector(const concurrent_vector &other) : concurrent_vector{} {
+    reserve(other.size());
+    for (size_type pos = 0, n = other.size(); pos < n; ++pos)
+      if (other.built(pos))
+        push_back(other[pos]);
+  }
+
+  concurrent_vector(concurrent_vector &&other) noexcept : concurrent_vector{} {
+    swap(other);
+  }
+
+  ~concurrent_vector() noexcept {
+    clear();
+    for (auto &segment : segments_)
+      if (T *s = segment.load(std::memory_order_relaxed))
+        deallocate_segment(s);
+  }
+
+  concurrent_vector &operator=(const concurrent_vector &other) {
+    concurrent_vector w{other};
+    swap(w);
+    return *this;
+  }
+
+  concurrent_vector &operator=(concurrent_vector &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  T &operator[](size_type pos) noexcept { return *slot(pos); }
+  const T &operator[](size_type pos) const noexcept { return *slot(pos); }
+
+  T &at(size_type pos) {
+    check_range(pos);
+    return *slot(pos);
+  }
+
+  const T &at(size_type pos) const {
+    check_range(pos);
+    return *slot(pos);
+  }
+
+  T &front() noexcept { return *slot(0); }
+  const T &front() const noexcept { return *slot(0); }
+
+  //! Whether pos, below size(), holds an element: false if its constructor
+  //! threw. As for operator[], the append of pos must be known to be over.
+  bool built(size_type pos) const noexcept {
+    size_type k = segment_of(pos);
+    T *segment = segments_[k].load(std::memory_order_acquire);
+    return segment && flags(segment, k)[pos - segment_base(k)];
+  }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  //! Iterators cover the elements reserved when begin()/end() was called.
+  const_iterator begin() const noexcept { return const_iterator{this, 0}; }
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  const_iterator end() const noexcept { return const_iterator{this, size()}; }
+  const_iterator cend() const noexcept { return end(); }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept {
+    return size_.load(std::memory_order_acquire);
+  }
+
+  size_type capacity() const noexcept {
+    size_type cap = 0;
+    for (size_type k = 0; k < max_segments; ++k)
+      if (segments_[k].load(std::memory_order_relaxed))
+        cap = segment_base(k) + segment_size(k);
+    return cap;
+  }
+
+  //! Allocate the segments needed for new_cap elements ahead of time.
+  void reserve(size_type new_cap) {
+    if (new_cap == 0)
+      return;
+    for (size_type k = 0, last = segment_of(new_cap - 1); k <= last; ++k)
+      ensure_segment(k);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  //! Append value and return a reference to it; lock-free and thread-safe.
+  T &push_back(const T &value) { return emplace_back(value); }
+
+  T &push_back(T &&value) { return emplace_back(std::move(value)); }
+
+  //! If T's constructor throws, the slot stays reserved but not built().
+  template <class... Args> T &emplace_back(Args &&... args) {
+    size_type pos = size_.fetch_add(1, std::memory_order_relaxed);
+    size_type k = segment_of(pos);
+    T *segment = ensure_segment(k);
+    size_type i = pos - segment_base(k);
+    new (segment + i) T(std::forward<Args>(args)...);
+    flags(segment, k)[i] = 1;
+    return segment[i];
+  }
+
+  //! Append n copies of value as one contiguous index range and return the
+  //! index of the first one; lock-free and thread-safe.
+  size_type grow_by(size_type n, const T &value = T()) {
+    return construct_range(n, value);
+  }
+
+  //! Destroy every element but keep the segments. Not thread-safe.
+  void clear() noexcept {
+    const size_type n = size();
+    for (size_type k = 0; k < max_segments && segment_base(k) < n; ++k) {
+      T *segment = segments_[k].load(std::memory_order_relaxed);
+      if (!segment) // its allocation threw
+        continue;
+      unsigned char *built = flags(segment, k);
+      for (size_type i = 0, m = std::min(segment_size(k), n - segment_base(k));
+           i < m; ++i)
+        if (built[i]) {
+          segment[i].~T();
+          built[i] = 0;
+        }
+    }
+    size_.store(0, std::memory_order_release);
+  }
+
+  //! Not thread-safe.
+  void swap(concurrent_vector &other) noexcept {
+    for (size_type k = 0; k < max_segments; ++k) {
+      T *mine = segments_[k].load(std::memory_order_relaxed);
+      segments_[k].store(other.segments_[k].load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+      other.segments_[k].store(mine, std::memory_order_relaxed);
+    }
+    size_type n = size_.load(std::memory_order_relaxed);
+    size_.store(other.size_.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    other.size_.store(n, std::memory_order_relaxed);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                              Iterator class                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  //! Forward iterator that only looks up the segment table when it crosses
+  //! a segment boundary.
+  class const_iterator {
+    const concurrent_vector *v_;
+    size_type pos_;
+    mutable const T *p_;
+    mutable size_type segment_end_;
+
+    void refresh() const noexcept {
+      size_type k = segment_of(pos_);
+      p_ = v_->segments_[k].load(std::memory_order_acquire) +
+           (pos_ - segment_base(k));
+      segment_end_ = segment_base(k) + segment_size(k);
+    }
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    const_iterator() noexcept
+        : v_{nullptr}, pos_{0}, p_{nullptr}, segment_end_{0} {}
+    const_iterator(const concurrent_vector *v, size_type pos) noexcept
+        : v_{v}, pos_{pos}, p_{nullptr}, segment_end_{0} {}
+
+    const T &operator*() const noexcept {
+      if (pos_ >= segment_end_)
+        refresh();
+      return *p_;
+    }
+
+    const T *operator->() const noexcept { return &**this; }
+
+    const_iterator &operator++() noexcept {
+      ++pos_;
+      if (p_)
+        ++p_;
+      return *this;
+    }
+
+    const_iterator operator++(int) noexcept {
+      const_iterator t{*this};
+      ++*this;
+      return t;
+    }
+
+    bool operator==(const const_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const const_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+  };
+};
+
+} // namespace phundrak
@@ -0,0 +1,213 @@
+#pragma once
+
+#include "vector.hh"
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! vector whose copies share one buffer until one of them is modified.
+//!
+//! Copying is O(1): it only bumps the atomic reference count of the shared
+//! buffer, so cow_vectors can be copied, passed by value and read from
+//! several threads. The first mutable access to a shared buffer detaches
+//! it, copying the elements into a buffer of its own.
+//!
+//! On a non-const cow_vector, operator[], data(), begin() and the other
+//! mutable accessors detach even when only used for reading. Read through
+//! the const overloads, or through read(), cdata(), cbegin(), cend() and
+//! get(), which never copy.
+//!
+//! A reference or pointer obtained through a mutable accessor must not be
+//! written through once the cow_vector has been copied: the copy shares
+//! the element it designates.
+template <class T, class Allocator = std::allocator<T>> class cow_vector {
+public:
+  using value_type = T;
+  using allocator_type = Allocator;
+  using storage_type = vector<T, Allocator>;
+
+private:
+  struct buffer {
+    template <class... Args>
+    explicit buffer(Args &&... args)
+        : refs{1}, values(std::forward<Args>(args)...) {}
+    std::atomic<size_type> refs;
+    storage_type values;
+  };
+
+  static buffer *share(buffer *b) noexcept {
+    if (b)
+      b->refs.fetch_add(1, std::memory_order_relaxed);
+    return b;
+  }
+
+  static void release(buffer *b) noexcept {
+    if (b && b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete b;
+  }
+
+  static const storage_type &empty_storage() {
+    static const storage_type empty{};
+    return empty;
+  }
+
+  //! The buffer, made unique to *this first.
+  storage_type &detach() {
+    if (!b_) {
+      b_ = new buffer{};
+    } else if (b_->refs.load(std::memory_order_acquire) != 1) {
+      buffer *own = new buffer{b_->values};
+      release(b_);
+      b_ = own;
+    }
+    return b_->values;
+  }
+
+  buffer *b_; // null when empty and never written
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  cow_vector() noexcept : b_{nullptr} {}
+
+  explicit cow_vector(const storage_type &values) : b_{new buffer{values}} {}
+
+  explicit cow_vector(storage_type &&values)
+      : b_{new buffer{std::move(values)}} {}
+
+  cow_vector(size_type count, const T &value)
+      : b_{new buffer{count, value}} {}
+
+  template <typename InputIt,
+            typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                      InputIt> * = nullptr>
+  cow_vector(InputIt first, InputIt last) : b_{new buffer{first, last}} {}
+
+  //! O(1): shares other's buffer.
+  cow_vector(const cow_vector &other) noexcept : b_{share(other.b_)} {}
+
+  cow_vector(cow_vector &&other) noexcept : b_{other.b_} {
+    other.b_ = nullptr;
+  }
+
+  ~cow_vector() noexcept { release(b_); }
+
+  //! O(1): shares other's buffer.
+  cow_vector &operator=(const cow_vector &other) noexcept {
+    buffer *b = share(other.b_);
+    release(b_);
+    b_ = b;
+    return *this;
+  }
+
+  cow_vector &operator=(cow_vector &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  // Read-only access ///////////////////////////////////////////////////////
+
+  //! The elements, without detaching.
+  const storage_type &read() const noexcept {
+    return b_ ? b_->values : empty_storage();
+  }
+
+  const T &get(size_type pos) const noexcept { return read()[pos]; }
+
+  const T &operator[](size_type pos) const noexcept { return read()[pos]; }
+
+  const T &at(size_type pos) const { return read().at(pos); }
+
+  const T &front() const noexcept { return read().front(); }
+
+  const T &back() const noexcept { return read().back(); }
+
+  const T *data() const noexcept { return read().data(); }
+  const T *cdata() const noexcept { return read().data(); }
+
+  const T *begin() const noexcept { return read().data(); }
+  const T *cbegin() const noexcept { return read().data(); }
+
+  const T *end() const noexcept { return read().data() + size(); }
+  const T *cend() const noexcept { return read().data() + size(); }
+
+  //! Whether no other cow_vector shares the buffer.
+  bool unique() const noexcept {
+    return !b_ || b_->refs.load(std::memory_order_acquire) == 1;
+  }
+
+  // Mutable access: detaches ///////////////////////////////////////////////
+
+  //! The elements, detached, for bulk changes.
+  storage_type &write() { return detach(); }
+
+  T &operator[](size_type pos) { return detach()[pos]; }
+
+  T &at(size_type pos) { return detach().at(pos); }
+
+  T &front() { return detach().front(); }
+
+  T &back() { return detach().back(); }
+
+  T *data() { return detach().data(); }
+
+  T *begin() { return detach().data(); }
+
+  T *end() {
+    storage_type &values = detach();
+    return values.data() + values.size();
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept { return b_ ? b_->values.size() : 0; }
+
+  size_type capacity() const noexcept {
+    return b_ ? b_->values.capacity() : 0;
+  }
+
+  void reserve(size_type new_cap) { detach().reserve(new_cap); }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  //! Does not copy a shared buffer, only lets go of it.
+  void clear() noexcept {
+    if (unique()) {
+      if (b_)
+        b_->values.clear();
+    } else {
+      release(b_);
+      b_ = nullptr;
+    }
+  }
+
+  void set(size_type pos, const T &value) { detach()[pos] = value; }
+
+  void push_back(const T &value) { detach().push_back(value); }
+
+  void push_back(T &&value) { detach().push_back(std::move(value)); }
+
+  template <class... Args> T &emplace_back(Args &&... args) {
+    return detach().emplace_back(std::forward<Args>(args)...);
+  }
+
+  void pop_back() { detach().pop_back(); }
+
+  void resize(size_type count, const T &value = T()) {
+    detach().resize(count, value);
+  }
+
+  void swap(cow_vector &other) noexcept { std::swap(b_, other.b_); }
+};
+
+} // namespace phundrak
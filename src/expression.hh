@@ -0,0 +1,347 @@
+#pragma once
+
+#include "vector.hh"
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+//! Lazy element-wise arithmetic on phundrak::vector.
+//!
+//! Arithmetic, comparison and math functions applied to vectors of
+//! arithmetic types do not compute anything: they build a small expression
+//! tree that holds pointers to the vectors' data. Assigning the tree to a
+//! vector, or constructing a vector from it, evaluates it in a single loop
+//! that reads every operand once and writes the destination once, where
+//! chained temporaries would write and read back one full vector per
+//! operation. Reductions (sum, dot, min, max, any, all) run the same fused
+//! loop without storing anything.
+//!
+//!     phundrak::vector<double> a(n), b(n), c(n), d(n);
+//!     a = b * c + d;               // one pass, no temporary
+//!     double s = sum(a * a + 1.0); // one pass, no storage
+//!
+//! Expressions reference their vectors: they must not outlive them, and a
+//! vector must not be resized while an expression over it is alive.
+//! Operands must all have the same size. A scalar and the elements of the
+//! other operand combine in their common type, as in plain arithmetic:
+//! vector<int> * 0.5 is an expression of doubles, not a multiplication by 0.
+namespace phundrak {
+using size_type = size_t;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                Expressions                                //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Base of every expression node, E being the node type itself. Nodes
+//! provide value_type, size(), operator[] and references(p), which tells
+//! whether the node reads from the buffer starting at p.
+template <class E> struct vector_expression {
+  const E &self() const noexcept { return static_cast<const E &>(*this); }
+  size_type size() const noexcept { return self().size(); }
+  decltype(auto) operator[](size_type i) const { return self()[i]; }
+};
+
+//! Leaf reading the elements of a vector.
+template <class T>
+class vector_reference : public vector_expression<vector_reference<T>> {
+  const T *data_;
+  size_type size_;
+
+public:
+  using value_type = T;
+  static constexpr bool is_scalar = false;
+
+  vector_reference(const T *data, size_type size) noexcept
+      : data_{data}, size_{size} {}
+
+  size_type size() const noexcept { return size_; }
+  T operator[](size_type i) const noexcept { return data_[i]; }
+  bool references(const void *p) const noexcept { return p && p == data_; }
+};
+
+//! Leaf broadcasting one value to every position.
+template <class T>
+class scalar_expression : public vector_expression<scalar_expression<T>> {
+  T value_;
+
+public:
+  using value_type = T;
+  static constexpr bool is_scalar = true;
+
+  explicit scalar_expression(T value) noexcept : value_{value} {}
+
+  size_type size() const noexcept { return 0; }
+  T operator[](size_type) const noexcept { return value_; }
+  bool references(const void *) const noexcept { return false; }
+};
+
+template <class Op, class E>
+class unary_expression : public vector_expression<unary_expression<Op, E>> {
+  E e_;
+
+public:
+  using value_type =
+      std::decay_t<decltype(Op{}(std::declval<typename E::value_type>()))>;
+  static constexpr bool is_scalar = E::is_scalar;
+
+  explicit unary_expression(const E &e) : e_{e} {}
+
+  size_type size() const noexcept { return e_.size(); }
+  value_type operator[](size_type i) const { return Op{}(e_[i]); }
+  bool references(const void *p) const noexcept { return e_.references(p); }
+};
+
+template <class Op, class L, class R>
+class binary_expression
+    : public vector_expression<binary_expression<Op, L, R>> {
+  L l_;
+  R r_;
+
+public:
+  using value_type = std::decay_t<decltype(Op{}(
+      std::declval<typename L::value_type>(),
+      std::declval<typename R::value_type>()))>;
+  static constexpr bool is_scalar = L::is_scalar && R::is_scalar;
+
+  binary_expression(const L &l, const R &r) : l_{l}, r_{r} {
+    try {
+      if (!L::is_scalar && !R::is_scalar && l_.size() != r_.size())
+        throw std::length_error("Operands of different sizes");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << " (" << l_.size() << " and " << r_.size()
+                << ") in phundrak::binary_expression " << this << '\n';
+      std::terminate();
+    }
+  }
+
+  size_type size() const noexcept {
+    return L::is_scalar ? r_.size() : l_.size();
+  }
+  value_type operator[](size_type i) const { return Op{}(l_[i], r_[i]); }
+  bool references(const void *p) const noexcept {
+    return l_.references(p) || r_.references(p);
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Operands                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+namespace expression_detail {
+
+template <class T> struct is_vector : std::false_type {};
+template <class T, class A>
+struct is_vector<vector<T, A>> : std::is_arithmetic<T> {};
+
+template <class T>
+constexpr bool is_operand =
+    is_vector<T>::value || std::is_base_of_v<vector_expression<T>, T>;
+
+template <class L, class R>
+constexpr bool is_binary =
+    (is_operand<L> && (is_operand<R> || std::is_arithmetic_v<R>)) ||
+    (std::is_arithmetic_v<L> && is_operand<R>);
+
+template <class T, class A>
+vector_reference<T> wrap(const vector<T, A> &v) noexcept {
+  static_assert(std::is_arithmetic_v<T>,
+                "vector expressions need arithmetic element types");
+  return vector_reference<T>{v.data(), v.size()};
+}
+
+template <class E> E wrap(const vector_expression<E> &e) { return e.self(); }
+
+template <class X> struct element {
+  using type = typename X::value_type;
+};
+template <class T, class A> struct element<vector<T, A>> { using type = T; };
+
+//! x as an expression node; a scalar becomes a scalar_expression of its
+//! common type with the elements of Other, the operand on the other side,
+//! so that a double is never truncated to an int element type.
+template <class Other, class X> auto operand(const X &x) {
+  if constexpr (std::is_arithmetic_v<X>) {
+    using T = std::common_type_t<typename element<Other>::type, X>;
+    return scalar_expression<T>{static_cast<T>(x)};
+  } else {
+    return wrap(x);
+  }
+}
+
+template <class Op, class L, class R> auto make_binary(const L &l, const R &r) {
+  auto lhs = operand<R>(l);
+  auto rhs = operand<L>(r);
+  return binary_expression<Op, decltype(lhs), decltype(rhs)>{lhs, rhs};
+}
+
+#define PHUNDRAK_EXPRESSION_FUNCTION(name, expr)                               \
+  struct name {                                                                \
+    template <class X> auto operator()(X x) const { return expr; }             \
+  }
+
+PHUNDRAK_EXPRESSION_FUNCTION(abs_op, std::abs(x));
+PHUNDRAK_EXPRESSION_FUNCTION(sqrt_op, std::sqrt(x));
+PHUNDRAK_EXPRESSION_FUNCTION(exp_op, std::exp(x));
+PHUNDRAK_EXPRESSION_FUNCTION(log_op, std::log(x));
+PHUNDRAK_EXPRESSION_FUNCTION(sin_op, std::sin(x));
+PHUNDRAK_EXPRESSION_FUNCTION(cos_op, std::cos(x));
+
+#undef PHUNDRAK_EXPRESSION_FUNCTION
+
+struct pow_op {
+  template <class X, class Y> auto operator()(X x, Y y) const {
+    return std::pow(x, y);
+  }
+};
+
+} // namespace expression_detail
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 Operators                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+#define PHUNDRAK_EXPRESSION_OPERATOR(op, functor)                              \
+  template <class L, class R,                                                  \
+            class = std::enable_if_t<expression_detail::is_binary<L, R>>>      \
+  auto operator op(const L &l, const R &r) {                                   \
+    return expression_detail::make_binary<functor>(l, r);                      \
+  }
+
+PHUNDRAK_EXPRESSION_OPERATOR(+, std::plus<>)
+PHUNDRAK_EXPRESSION_OPERATOR(-, std::minus<>)
+PHUNDRAK_EXPRESSION_OPERATOR(*, std::multiplies<>)
+PHUNDRAK_EXPRESSION_OPERATOR(/, std::divides<>)
+PHUNDRAK_EXPRESSION_OPERATOR(==, std::equal_to<>)
+PHUNDRAK_EXPRESSION_OPERATOR(!=, std::not_equal_to<>)
+PHUNDRAK_EXPRESSION_OPERATOR(<, std::less<>)
+PHUNDRAK_EXPRESSION_OPERATOR(<=, std::less_equal<>)
+PHUNDRAK_EXPRESSION_OPERATOR(>, std::greater<>)
+PHUNDRAK_EXPRESSION_OPERATOR(>=, std::greater_equal<>)
+
+#undef PHUNDRAK_EXPRESSION_OPERATOR
+
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+auto operator-(const X &x) {
+  auto e = expression_detail::wrap(x);
+  return unary_expression<std::negate<>, decltype(e)>{e};
+}
+
+#define PHUNDRAK_EXPRESSION_MATH(name)                                         \
+  template <class X,                                                           \
+            class = std::enable_if_t<expression_detail::is_operand<X>>>        \
+  auto name(const X &x) {                                                      \
+    auto e = expression_detail::wrap(x);                                       \
+    return unary_expression<expression_detail::name##_op, decltype(e)>{e};     \
+  }
+
+PHUNDRAK_EXPRESSION_MATH(abs)
+PHUNDRAK_EXPRESSION_MATH(sqrt)
+PHUNDRAK_EXPRESSION_MATH(exp)
+PHUNDRAK_EXPRESSION_MATH(log)
+PHUNDRAK_EXPRESSION_MATH(sin)
+PHUNDRAK_EXPRESSION_MATH(cos)
+
+#undef PHUNDRAK_EXPRESSION_MATH
+
+template <class L, class R,
+          class = std::enable_if_t<expression_detail::is_binary<L, R>>>
+auto pow(const L &l, const R &r) {
+  return expression_detail::make_binary<expression_detail::pow_op>(l, r);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                                Reductions                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Sum of the elements, in one pass. Four partial sums break the dependency
+//! between consecutive additions, so the result may differ from a strictly
+//! sequential sum in the last bits for floating-point types. Comparisons
+//! are counted: sum(a > b) is the size_type number of positions where
+//! a > b.
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+auto sum(const X &x) {
+  auto e = expression_detail::wrap(x);
+  using V = typename decltype(e)::value_type;
+  using T = std::conditional_t<std::is_same_v<V, bool>, size_type, V>;
+  T partial[4] = {T{}, T{}, T{}, T{}};
+  size_type n = e.size(), i = 0;
+  for (; i + 4 <= n; i += 4)
+    for (size_type k = 0; k < 4; ++k)
+      partial[k] += e[i + k];
+  for (; i < n; ++i)
+    partial[0] += e[i];
+  return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+}
+
+template <class L, class R,
+          class = std::enable_if_t<expression_detail::is_operand<L> &&
+                                   expression_detail::is_operand<R>>>
+auto dot(const L &l, const R &r) {
+  return sum(l * r);
+}
+
+namespace expression_detail {
+
+template <class E, class Better>
+typename E::value_type extremum(const E &e, Better better, const char *name) {
+  try {
+    if (e.size() == 0)
+      throw std::out_of_range("Empty expression");
+  } catch (const std::out_of_range &error) {
+    std::cout << error.what() << " in phundrak::" << name << '\n';
+    std::terminate();
+  }
+  typename E::value_type best = e[0];
+  for (size_type i = 1, n = e.size(); i < n; ++i) {
+    typename E::value_type v = e[i];
+    best = better(v, best) ? v : best;
+  }
+  return best;
+}
+
+} // namespace expression_detail
+
+//! Smallest element; the expression must not be empty.
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+auto min(const X &x) {
+  return expression_detail::extremum(expression_detail::wrap(x), std::less<>{},
+                                     "min");
+}
+
+//! Largest element; the expression must not be empty.
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+auto max(const X &x) {
+  return expression_detail::extremum(expression_detail::wrap(x),
+                                     std::greater<>{}, "max");
+}
+
+//! Whether any element converts to true; stops at the first one.
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+bool any(const X &x) {
+  auto e = expression_detail::wrap(x);
+  for (size_type i = 0, n = e.size(); i < n; ++i)
+    if (e[i])
+      return true;
+  return false;
+}
+
+//! Whether every element converts to true; stops at the first false one.
+template <class X,
+          class = std::enable_if_t<expression_detail::is_operand<X>>>
+bool all(const X &x) {
+  auto e = expression_detail::wrap(x);
+  for (size_type i = 0, n = e.size(); i < n; ++i)
+    if (!e[i])
+      return false;
+  return true;
+}
+
+} // namespace phundrak
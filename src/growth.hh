@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Capacity a container should grow to so that at least `required` elements
+//! fit, given its current capacity. Capacity doubles, starting from one
+//! element, so that repeated push_backs are amortised O(1).
+inline size_type grow_capacity(size_type capacity,
+                               size_type required) noexcept {
+  size_type new_cap = capacity ? capacity : 1;
+  while (new_cap < required)
+    new_cap <<= 1;
+  return new_cap;
+}
+
+} // namespace phundrak
@@ -0,0 +1,428 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Unordered bucket container with stable addresses, also known as a colony.
+//!
+//! Elements live in blocks of growing capacity. Erasing an element only
+//! destroys it and marks its slot as free: nothing else moves, so pointers,
+//! references and iterators to other elements stay valid until they are
+//! erased themselves. Freed slots are reused by later insertions.
+//!
+//! Every block keeps a skip field with one entry per slot: zero for a live
+//! element, and the length of the run for the first and last slot of every
+//! run of erased slots. Iteration reads the entry of the slot after the one
+//! it just left and jumps over the whole run at once. Runs are also chained
+//! in a per-block free list so that insertion and erasure are O(1).
+template <class T> class hive {
+public:
+  template <bool Const> class basic_iterator;
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+
+  static constexpr size_type min_block_capacity = 8;
+  static constexpr size_type max_block_capacity = 8192;
+
+private:
+  using skip_type = std::uint16_t;
+  static constexpr skip_type none = 0xFFFF;
+
+  // data structure ///////////////////////////////////////////////////////////
+
+  //! Free-list links of an erased run, stored in the run's first slot.
+  struct free_links {
+    skip_type prev;
+    skip_type next;
+  };
+
+  union slot {
+    slot() noexcept {}
+    ~slot() {}
+    T value;
+    free_links link;
+  };
+
+  struct block {
+    explicit block(size_type cap)
+        : slots{new slot[cap]}, skip{new skip_type[cap + 1]()}, capacity{cap},
+          end{0}, size{0}, free_head{none}, prev{nullptr}, next{nullptr},
+          prev_free{nullptr}, next_free{nullptr} {}
+    block(const block &) = delete;
+    block &operator=(const block &) = delete;
+    ~block() {
+      delete[] slots;
+      delete[] skip;
+    }
+
+    slot *slots;
+    skip_type *skip; // capacity + 1 entries, the last one always 0
+    size_type capacity;
+    size_type end;  // slots past end have never been used
+    size_type size; // live elements
+    skip_type free_head;
+    block *prev, *next;           // every block, in iteration order
+    block *prev_free, *next_free; // blocks that have erased runs
+  };
+
+  // block bookkeeping ////////////////////////////////////////////////////////
+
+  void push_free_block(block *b) noexcept {
+    b->prev_free = nullptr;
+    b->next_free = free_blocks_;
+    if (free_blocks_)
+      free_blocks_->prev_free = b;
+    free_blocks_ = b;
+  }
+
+  void unlink_free_block(block *b) noexcept {
+    if (b->prev_free)
+      b->prev_free->next_free = b->next_free;
+    else
+      free_blocks_ = b->next_free;
+    if (b->next_free)
+      b->next_free->prev_free = b->prev_free;
+    b->prev_free = b->next_free = nullptr;
+  }
+
+  block *append_block() {
+    size_type cap = last_ ? last_->capacity << 1 : min_block_capacity;
+    if (cap > max_block_capacity)
+      cap = max_block_capacity;
+    block *b = new block{cap};
+    b->prev = last_;
+    if (last_)
+      last_->next = b;
+    else
+      first_ = b;
+    last_ = b;
+    capacity_ += cap;
+    return b;
+  }
+
+  void remove_block(block *b) noexcept {
+    if (b->free_head != none)
+      unlink_free_block(b);
+    if (b->prev)
+      b->prev->next = b->next;
+    else
+      first_ = b->next;
+    if (b->next)
+      b->next->prev = b->prev;
+    else
+      last_ = b->prev;
+    capacity_ -= b->capacity;
+    delete b;
+  }
+
+  // free runs ////////////////////////////////////////////////////////////////
+
+  static void set_run(block *b, size_type start, size_type length) noexcept {
+    b->skip[start] = static_cast<skip_type>(length);
+    b->skip[start + length - 1] = static_cast<skip_type>(length);
+  }
+
+  void push_run(block *b, size_type start) noexcept {
+    if (b->free_head == none)
+      push_free_block(b);
+    else
+      b->slots[b->free_head].link.prev = static_cast<skip_type>(start);
+    b->slots[start].link = free_links{none, b->free_head};
+    b->free_head = static_cast<skip_type>(start);
+  }
+
+  void unlink_run(block *b, size_type start) noexcept {
+    free_links link = b->slots[start].link;
+    if (link.prev != none)
+      b->slots[link.prev].link.next = link.next;
+    else
+      b->free_head = link.next;
+    if (link.next != none)
+      b->slots[link.next].link.prev = link.prev;
+    if (b->free_head == none)
+      unlink_free_block(b);
+  }
+
+  //! Move the free-list node of a run from slot `from` to slot `to`.
+  static void move_run(block *b, size_type from, size_type to) noexcept {
+    free_links link = b->slots[from].link;
+    b->slots[to].link = link;
+    if (link.prev != none)
+      b->slots[link.prev].link.next = static_cast<skip_type>(to);
+    else
+      b->free_head = static_cast<skip_type>(to);
+    if (link.next != none)
+      b->slots[link.next].link.prev = static_cast<skip_type>(to);
+  }
+
+  //! Find a slot for a new element and mark it live.
+  std::pair<block *, size_type> acquire_slot() {
+    if (free_blocks_) {
+      block *b = free_blocks_;
+      size_type idx = b->free_head;
+      size_type length = b->skip[idx];
+      if (length == 1) {
+        unlink_run(b, idx);
+      } else {
+        move_run(b, idx, idx + 1);
+        set_run(b, idx + 1, length - 1);
+      }
+      b->skip[idx] = 0;
+      return {b, idx};
+    }
+    block *b = (last_ && last_->end < last_->capacity) ? last_ : append_block();
+    return {b, b->end++};
+  }
+
+  //! Give an element's slot back, merging it with neighbouring runs.
+  void release_slot(block *b, size_type idx) noexcept {
+    size_type left = idx > 0 ? b->skip[idx - 1] : 0;
+    size_type right = b->skip[idx + 1];
+    if (left && right) {
+      unlink_run(b, idx + 1);
+      set_run(b, idx - left, left + 1 + right);
+    } else if (left) {
+      set_run(b, idx - left, left + 1);
+    } else if (right) {
+      move_run(b, idx + 1, idx);
+      set_run(b, idx, right + 1);
+    } else {
+      push_run(b, idx);
+      set_run(b, idx, 1);
+    }
+  }
+
+  // members //////////////////////////////////////////////////////////////////
+
+  block *first_;
+  block *last_;
+  block *free_blocks_;
+  size_type size_;
+  size_type capacity_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  hive() noexcept
+      : first_{nullptr}, last_{nullptr}, free_blocks_{nullptr}, size_{0},
+        capacity_{0} {}
+
+  hive(std::initializer_list<T> init) : hive{} {
+    for (const T &elem : init)
+      insert(elem);
+  }
+
+  template <class InputIt> hive(InputIt first, InputIt last) : hive{} {
+    for (; first != last; ++first)
+      insert(*first);
+  }
+
+  hive(const hive &other) : hive{} {
+    for (const T &elem : other)
+      insert(elem);
+  }
+
+  hive(hive &&other) noexcept : hive{} { swap(other); }
+
+  ~hive() noexcept { clear(); }
+
+  hive &operator=(const hive &other) {
+    hive w{other};
+    swap(w);
+    return *this;
+  }
+
+  hive &operator=(hive &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  iterator begin() noexcept {
+    return first_ ? iterator{first_, first_->skip[0]} : iterator{};
+  }
+  const_iterator begin() const noexcept {
+    return first_ ? const_iterator{first_, first_->skip[0]} : const_iterator{};
+  }
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  iterator end() noexcept {
+    return last_ ? iterator{last_, last_->end} : iterator{};
+  }
+  const_iterator end() const noexcept {
+    return last_ ? const_iterator{last_, last_->end} : const_iterator{};
+  }
+  const_iterator cend() const noexcept { return end(); }
+
+  //! Iterator to the element p points to, which must be in this hive.
+  iterator get_iterator(const T *p) noexcept {
+    const slot *s = reinterpret_cast<const slot *>(p);
+    for (block *b = first_; b; b = b->next)
+      if (s >= b->slots && s < b->slots + b->end)
+        return iterator{b, static_cast<size_type>(s - b->slots)};
+    return end();
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type capacity() const noexcept { return capacity_; }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void clear() noexcept {
+    for (auto it = begin(); it != end(); ++it)
+      (*it).~T();
+    while (first_)
+      remove_block(first_);
+    size_ = 0;
+  }
+
+  template <class... Args> iterator emplace(Args &&... args) {
+    bool reused = free_blocks_ != nullptr;
+    auto [b, idx] = acquire_slot();
+    try {
+      new (&b->slots[idx].value) T(std::forward<Args>(args)...);
+    } catch (...) {
+      // the slot is already marked live: hand it back
+      if (reused)
+        release_slot(b, idx);
+      else
+        --b->end;
+      throw;
+    }
+    ++b->size;
+    ++size_;
+    return iterator{b, idx};
+  }
+
+  iterator insert(const T &value) { return emplace(value); }
+  iterator insert(T &&value) { return emplace(std::move(value)); }
+
+  //! Destroy the element at pos. Only iterators and pointers to that element
+  //! are invalidated.
+  iterator erase(const_iterator pos) {
+    block *b = pos.b_;
+    size_type idx = pos.i_;
+    const_iterator next = std::next(pos);
+    b->slots[idx].value.~T();
+    --size_;
+    if (--b->size == 0) {
+      bool was_last = next.b_ == b;
+      remove_block(b);
+      return was_last ? end() : iterator{next.b_, next.i_};
+    }
+    release_slot(b, idx);
+    return iterator{next.b_, next.i_};
+  }
+
+  //! Erasing up to end() stops at the end() of the moment: freeing the last
+  //! block moves end() away from last.
+  iterator erase(const_iterator first, const_iterator last) {
+    bool to_end = last == cend();
+    while (to_end ? first != cend() : first != last)
+      first = erase(first);
+    return iterator{first.b_, first.i_};
+  }
+
+  void swap(hive &other) noexcept {
+    std::swap(first_, other.first_);
+    std::swap(last_, other.last_);
+    std::swap(free_blocks_, other.free_blocks_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                              Iterator class                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  template <bool Const> class basic_iterator {
+    block *b_;
+    size_type i_;
+
+    basic_iterator(block *b, size_type i) noexcept : b_{b}, i_{i} {}
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = std::conditional_t<Const, const T *, T *>;
+    using reference = std::conditional_t<Const, const T &, T &>;
+
+    basic_iterator() noexcept : b_{nullptr}, i_{0} {}
+
+    template <bool C = Const, class = std::enable_if_t<C>>
+    basic_iterator(const basic_iterator<false> &other) noexcept
+        : b_{other.b_}, i_{other.i_} {}
+
+    reference operator*() const noexcept { return b_->slots[i_].value; }
+    pointer operator->() const noexcept { return &b_->slots[i_].value; }
+
+    basic_iterator &operator++() noexcept {
+      ++i_;
+      i_ += b_->skip[i_];
+      if (i_ >= b_->end && b_->next) {
+        b_ = b_->next;
+        i_ = b_->skip[0];
+      }
+      return *this;
+    }
+
+    basic_iterator operator++(int) noexcept {
+      basic_iterator t{*this};
+      ++*this;
+      return t;
+    }
+
+    basic_iterator &operator--() noexcept {
+      for (;;) {
+        if (i_ == 0) {
+          b_ = b_->prev;
+          i_ = b_->end;
+        }
+        --i_;
+        size_type s = b_->skip[i_];
+        if (s <= i_) {
+          i_ -= s;
+          return *this;
+        }
+        i_ = 0; // the run reaches the start of the block
+      }
+    }
+
+    basic_iterator operator--(int) noexcept {
+      basic_iterator t{*this};
+      --*this;
+      return t;
+    }
+
+    bool operator==(const basic_iterator &o) const noexcept {
+      return b_ == o.b_ && i_ == o.i_;
+    }
+    bool operator!=(const basic_iterator &o) const noexcept {
+      return !(*this == o);
+    }
+
+    friend class hive;
+    friend class basic_iterator<!Const>;
+  };
+};
+
+} // namespace phundrak
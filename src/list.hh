@@ -1,7 +1,14 @@
+#pragma once
+
+#include "perf_counter.hh"
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace phundrak {
@@ -22,36 +29,269 @@ namespace phundrak {
     // data structure ///////////////////////////////////////////////////////////
 
     struct cell {
-      cell() = default;
-      explicit cell(const T &value) : x{value}, p{nullptr}, n{nullptr} {}
-      explicit cell(T &&value) : x{value}, p{nullptr}, n{nullptr} {}
-      cell(const cell &other) : x{other.x}, p{other.p}, n{other.n} {}
-      cell(cell &&other) : x{T{}}, p{nullptr}, n{nullptr} {
-        std::swap(x, other.x);
-        std::swap(p, other.p);
-        std::swap(n, other.n);
-      }
-      cell &operator=(const cell &other) {
-        x = other.x;
-        p = other.p;
-        n = other.n;
-        return *this;
-      }
-      cell &operator=(cell &&other) {
-        std::swap(x, other.x);
-        std::swap(n, other.n);
-        std::swap(p, other.p);
-        return *this;
-      }
+      template <class... Args>
+      explicit cell(std::in_place_t, Args &&... args)
+        : p{nullptr}, n{nullptr}, x(std::forward<Args>(args)...) {}
+      cell(const cell &) = delete;
+      cell &operator=(const cell &) = delete;
       cell *p;
       cell *n;
       T x;
     };
 
+    // node storage /////////////////////////////////////////////////////////////
+
+    //! Cells are carved in order out of blocks of whole pages, page_bytes
+    //! bytes each and aligned on page_bytes, so that the page holding a cell
+    //! is found by masking its address; every page starts with a header that
+    //! points to the first one, where the block is described. A list's first
+    //! block is a single page and each new one doubles, up to
+    //! max_block_pages, so that small lists stay small. A block counts the
+    //! cells handed out from it, live or waiting in a free list, plus one
+    //! while new cells are still bumped from it, and is freed when that count
+    //! drops to zero. Counting instead of tying a block to one list keeps
+    //! cells valid when they are spliced into another list, but two lists
+    //! that exchanged cells must not be modified concurrently.
+    struct block_header {
+      block_header *owner; // first page of the block
+      size_type refs;      // first page only
+      size_type pages;     // first page only
+    };
+
+    static constexpr size_type round_page(size_type bytes) noexcept {
+      size_type b = 64;
+      while (b < bytes)
+        b <<= 1;
+      return b;
+    }
+
+    static constexpr size_type header_bytes =
+      (sizeof(block_header) + alignof(cell) - 1) / alignof(cell) * alignof(cell);
+    static constexpr size_type page_bytes =
+      round_page(header_bytes + 8 * sizeof(cell));
+    static constexpr size_type cells_per_page =
+      (page_bytes - header_bytes) / sizeof(cell);
+    static constexpr size_type max_block_pages =
+      page_bytes < (size_type{1} << 16) ? (size_type{1} << 16) / page_bytes : 1;
+
+    struct alignas(page_bytes) page {
+      unsigned char bytes[page_bytes];
+    };
+
+    using alloc_traits = std::allocator_traits<Allocator>;
+    using page_allocator = typename alloc_traits::template rebind_alloc<page>;
+    using page_traits = std::allocator_traits<page_allocator>;
+    using cell_allocator = typename alloc_traits::template rebind_alloc<cell>;
+    using cell_traits = std::allocator_traits<cell_allocator>;
+
+    static block_header *block_of(const cell *c) noexcept {
+      auto addr = reinterpret_cast<std::uintptr_t>(c);
+      return reinterpret_cast<block_header *>(addr & ~(page_bytes - 1))->owner;
+    }
+
+    void unref_block(block_header *b) noexcept {
+      if (--b->refs == 0) {
+        page_allocator alloc{alloc_};
+        page_traits::deallocate(alloc, reinterpret_cast<page *>(b), b->pages);
+      }
+    }
+
+    void new_bump_block() {
+      page_allocator alloc{alloc_};
+      page *raw = page_traits::allocate(alloc, block_pages_);
+      auto *head = new (static_cast<void *>(raw))
+        block_header{nullptr, 1, block_pages_};
+      head->owner = head;
+      for (size_type i = 1; i < block_pages_; ++i)
+        new (static_cast<void *>(raw + i)) block_header{head, 0, 0};
+      if (bump_block_)
+        unref_block(bump_block_);
+      bump_block_ = head;
+      next_page_ = raw;
+      last_page_ = raw + block_pages_;
+      block_pages_ = std::min(2 * block_pages_, max_block_pages);
+    }
+
+    //! Raw storage for one cell from the current block: consecutive calls
+    //! return adjacent cells, but for the header at the start of each page.
+    cell *bump_cell() {
+      if (bump_ == bump_end_) {
+        if (next_page_ == last_page_)
+          new_bump_block();
+        bump_ = reinterpret_cast<cell *>(next_page_->bytes + header_bytes);
+        bump_end_ = bump_ + cells_per_page;
+        ++next_page_;
+      }
+      ++bump_block_->refs;
+      return bump_++;
+    }
+
+    //! Raw storage for one cell, reusing freed cells first.
+    cell *acquire_cell() {
+      if (free_cells_) {
+        cell *c = free_cells_;
+        free_cells_ = *std::launder(reinterpret_cast<cell **>(c));
+        return c;
+      }
+      return bump_cell();
+    }
+
+    void release_cell(cell *c) noexcept {
+      new (static_cast<void *>(c)) cell *{free_cells_};
+      free_cells_ = c;
+    }
+
+    template <class... Args> cell *make_cell(Args &&... args) {
+      cell *c = acquire_cell();
+      try {
+        new (c) cell{std::in_place, std::forward<Args>(args)...};
+      } catch (...) {
+        release_cell(c);
+        throw;
+      }
+      return c;
+    }
+
+    void destroy_cell(cell *c) noexcept {
+      c->~cell();
+      release_cell(c);
+    }
+
+    //! Give the free cells back to their blocks.
+    void drop_free_cells() noexcept {
+      while (free_cells_) {
+        cell *c = free_cells_;
+        free_cells_ = *std::launder(reinterpret_cast<cell **>(c));
+        unref_block(block_of(c));
+      }
+    }
+
+    // linking //////////////////////////////////////////////////////////////////
+
+    //! The sentry only uses its links: its element is never constructed, so
+    //! that T need not be default constructible.
+    static cell *make_sentry(const Allocator &alloc) {
+      cell_allocator cells{alloc};
+      cell *s = cell_traits::allocate(cells, 1);
+      s->p = s;
+      s->n = s;
+      return s;
+    }
+
+    void link_before(cell *pos, cell *c) noexcept {
+      c->n = pos;
+      c->p = pos->p;
+      pos->p->n = c;
+      pos->p = c;
+      ++size_;
+    }
+
+    //! Relink [first, last), from this list or another one, before pos,
+    //! which is not in the range. Sizes are left to the caller.
+    static void transfer(cell *pos, cell *first, cell *last) noexcept {
+      if (first == last || pos == last)
+        return;
+      cell *tail = last->p;
+      first->p->n = last;
+      last->p = first->p;
+      pos->p->n = first;
+      first->p = pos->p;
+      tail->n = pos;
+      pos->p = tail;
+    }
+
+    //! Unlink and destroy c, returning the cell that followed it.
+    cell *unlink(cell *c) noexcept {
+      cell *next = c->n;
+      c->p->n = next;
+      next->p = c->p;
+      destroy_cell(c);
+      --size_;
+      ++churn_;
+      return next;
+    }
+
+    // chains ///////////////////////////////////////////////////////////////////
+
+    //! Cells built for a range operation before they are linked in, with
+    //! null p in the first cell and null n in the last one.
+    struct chain {
+      cell *first;
+      cell *last;
+      size_type size;
+    };
+
+    //! Append an element made from args to c. Range operations skip the
+    //! free list, whose cells are scattered, so that a chain is laid out in
+    //! order in as few blocks as possible. If the element cannot be built,
+    //! the whole chain is destroyed and the list is left untouched.
+    template <class... Args> void extend(chain &c, Args &&... args) {
+      cell *fresh = bump_cell();
+      try {
+        new (fresh) cell{std::in_place, std::forward<Args>(args)...};
+      } catch (...) {
+        release_cell(fresh);
+        for (cell *it = c.first; it;) {
+          cell *next = it->n;
+          destroy_cell(it);
+          it = next;
+        }
+        throw;
+      }
+      fresh->p = c.last;
+      (c.last ? c.last->n : c.first) = fresh;
+      c.last = fresh;
+      ++c.size;
+    }
+
+    template <class InputIt> chain make_chain(InputIt first, InputIt last) {
+      chain c{nullptr, nullptr, 0};
+      for (; first != last; ++first)
+        extend(c, *first);
+      return c;
+    }
+
+    //! count copies of value, or count value-initialised elements.
+    template <class... Value>
+    chain make_chain_n(size_type count, const Value &... value) {
+      chain c{nullptr, nullptr, 0};
+      while (c.size < count)
+        extend(c, value...);
+      return c;
+    }
+
+    //! Link c before pos with a single relink; returns its first element,
+    //! or pos if it is empty.
+    iterator link_chain(cell *pos, const chain &c) noexcept {
+      if (!c.first)
+        return iterator{pos};
+      c.first->p = pos->p;
+      c.last->n = pos;
+      pos->p->n = c.first;
+      pos->p = c.last;
+      size_ += c.size;
+      return iterator{c.first};
+    }
+
+    void maybe_compact() {
+      if (auto_compact_ && churn_ >= auto_compact_ && churn_ >= size_)
+        compact();
+    }
+
     // members //////////////////////////////////////////////////////////////////
 
     cell *sentry;
     const Allocator alloc_;
+    size_type size_;
+    cell *free_cells_;
+    block_header *bump_block_;
+    cell *bump_;
+    cell *bump_end_;
+    page *next_page_;        // pages of bump_block_ not bumped from yet
+    page *last_page_;
+    size_type block_pages_;  // size of the next block
+    size_type churn_;        // cells erased since the last compaction
+    size_type auto_compact_; // churn that triggers compact(), 0 to disable
 
   public:
     /////////////////////////////////////////////////////////////////////////////
@@ -60,109 +300,106 @@ namespace phundrak {
 
     // Constructors /////////////////////////////////////////////////////////////
 
-    list() : list{Allocator()}, sentry{new cell{}} {}
+    list() : list{Allocator()} {}
 
-    explicit list(const Allocator &alloc) : sentry{new cell{}}, alloc_{alloc} {
-      sentry->p = sentry;
-      sentry->n = sentry;
-    }
+    explicit list(const Allocator &alloc)
+      : sentry{make_sentry(alloc)}, alloc_{alloc}, size_{0},
+        free_cells_{nullptr}, bump_block_{nullptr}, bump_{nullptr},
+        bump_end_{nullptr}, next_page_{nullptr}, last_page_{nullptr},
+        block_pages_{1}, churn_{0}, auto_compact_{0} {}
 
+    //! Range constructors build all their cells in one chain, see extend().
     list(size_type count, const T &value, const Allocator &alloc = Allocator())
       : list{alloc} {
-      while (size() < count)
-        push_back(value);
+      link_chain(sentry, make_chain_n(count, value));
     }
 
     explicit list(size_type count, const Allocator &alloc = Allocator())
       : list{alloc} {
-      while (size() < count)
-        push_back(T());
+      link_chain(sentry, make_chain_n(count));
     }
 
-    template <class InputIt>
+    template <typename InputIt,
+              typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                        InputIt> * = nullptr>
     list(InputIt first, InputIt last, const Allocator &alloc = Allocator())
       : list{alloc} {
-      for (;first != last; ++first)
-        push_back(*first);
+      link_chain(sentry, make_chain(first, last));
     }
 
-    list(const list &other) : list() {
-      for (auto elem : other)
-        push_back(elem);
+    list(const list &other)
+      : list(alloc_traits::select_on_container_copy_construction(
+          other.alloc_)) {
+      link_chain(sentry, make_chain(other.begin(), other.end()));
     }
 
     list(const list &other, const Allocator &alloc) : list(alloc) {
-      for (auto elem : other)
-        push_back(elem);
+      link_chain(sentry, make_chain(other.begin(), other.end()));
     }
 
-    list(list &&other) : list() {
-      std::swap(other.sentry, sentry);
-      std::swap(other.alloc_, alloc_);
-    }
+    list(list &&other) : list(other.alloc_) { swap(other); }
 
-    list(list &&other, const Allocator &alloc) : list(alloc) {
-      std::swap(other.sentry, sentry);
-    }
+    list(list &&other, const Allocator &alloc) : list(alloc) { swap(other); }
 
     list(std::initializer_list<T> init, const Allocator &alloc = Allocator())
       : list(alloc) {
-      for (const T &elem : init)
-        push_back(elem);
+      link_chain(sentry, make_chain(init.begin(), init.end()));
     }
 
     // Destructor ///////////////////////////////////////////////////////////////
 
     virtual ~list() {
       clear();
-      delete sentry;
+      if (bump_block_)
+        unref_block(bump_block_);
+      cell_allocator cells{alloc_};
+      cell_traits::deallocate(cells, sentry, 1);
     }
 
     // operator= ////////////////////////////////////////////////////////////////
 
     list &operator=(const list &other) {
-      cell *it = other.sentry->n;
-      while (it != other.sentry) {
-        push_back(it->x);
-        it = it->n;
-      }
+      list w{other};
+      swap(w);
       return *this;
     }
 
     list &operator=(list &&other) noexcept {
-      std::swap(other.sentry, sentry);
+      swap(other);
       return *this;
     }
 
     list &operator=(std::initializer_list<T> ilist) {
-      for (const T &elem : ilist)
-        push_back(elem);
+      assign(ilist);
       return *this;
     }
 
     // Assign ///////////////////////////////////////////////////////////////////
 
+    //! The new elements are built before the old ones are destroyed, so
+    //! that a throwing element leaves the list as it was.
     void assign(size_type count, const T &value) {
+      chain c = make_chain_n(count, value);
       clear();
-      for (int i = 0; i < count; ++i)
-        push_front(value);
+      link_chain(sentry, c);
     }
 
-    template <class InputIt> void assign(InputIt first, InputIt last) {
+    template <typename InputIt,
+              typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                        InputIt> * = nullptr>
+    void assign(InputIt first, InputIt last) {
+      chain c = make_chain(first, last);
       clear();
-      for (; first != last; ++first)
-        push_back(*first);
+      link_chain(sentry, c);
     }
 
     void assign(std::initializer_list<T> ilist) {
-      clear();
-      for (const T &elem : ilist)
-        push_back(elem);
+      assign(ilist.begin(), ilist.end());
     }
 
     // get_allocator ////////////////////////////////////////////////////////////
 
-    std::allocator<T> get_allocator() { return alloc_; }
+    Allocator get_allocator() const { return alloc_; }
 
     /////////////////////////////////////////////////////////////////////////////
     //                              Element access                             //
@@ -212,15 +449,7 @@ namespace phundrak {
 
     bool empty() const noexcept { return sentry->p == sentry; }
 
-    size_type size() const {
-      cell *it = sentry->n;
-      size_type n = 0;
-      while (it != sentry) {
-        ++n;
-        it = it->n;
-      }
-      return n;
-    }
+    size_type size() const noexcept { return size_; }
 
     /////////////////////////////////////////////////////////////////////////////
     //                                Modifiers                                //
@@ -228,147 +457,128 @@ namespace phundrak {
 
     // clear ////////////////////////////////////////////////////////////////////
 
+    //! Destroy every element and give the memory of the cells back.
     void clear() {
+      PHUNDRAK_PERF_SCOPE("list::clear");
       cell *it = sentry->n;
       while (it != sentry) {
         cell *todel = it;
         it = it->n;
-        delete todel;
+        destroy_cell(todel);
       }
+      sentry->n = sentry;
+      sentry->p = sentry;
+      size_ = 0;
+      churn_ = 0;
+      drop_free_cells();
     }
 
     // insert ///////////////////////////////////////////////////////////////////
 
     iterator insert(const_iterator pos, const T &value) {
-      cell *elem = new cell{value};
-      elem->n = pos;
-      elem->p = pos->p;
-      pos->p->n = elem;
-      pos->p = elem;
-      return iterator{pos};
+      PHUNDRAK_PERF_SCOPE("list::insert");
+      return emplace(pos, value);
     }
 
     iterator insert(const_iterator pos, T &&value) {
-      cell *elem = new cell{value};
-      elem->n = pos;
-      elem->p = pos->p;
-      pos->p->n = elem;
-      pos->p = elem;
-      return iterator{pos};
+      PHUNDRAK_PERF_SCOPE("list::insert");
+      return emplace(pos, std::move(value));
     }
 
-    template <class InputIt>
+    template <typename InputIt,
+              typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                        InputIt> * = nullptr>
     iterator insert(const_iterator pos, InputIt first, InputIt last) {
-      for (; first != last; ++first)
-        insert(pos, *first);
-      return iterator{pos};
+      PHUNDRAK_PERF_SCOPE("list::insert");
+      return link_chain(pos.it, make_chain(first, last));
+    }
+
+    iterator insert(const_iterator pos, size_type count, const T &value) {
+      PHUNDRAK_PERF_SCOPE("list::insert");
+      return link_chain(pos.it, make_chain_n(count, value));
+    }
+
+    iterator insert(const_iterator pos, std::initializer_list<T> ilist) {
+      return insert(pos, ilist.begin(), ilist.end());
     }
 
     // emplace //////////////////////////////////////////////////////////////////
 
     template <class... Args>
     iterator emplace(const_iterator pos, Args &&... args) {
-      return insert(pos, T{std::forward<Args>(args)...});
+      cell *elem = make_cell(std::forward<Args>(args)...);
+      link_before(pos.it, elem);
+      return iterator{elem};
     }
 
     // erase ////////////////////////////////////////////////////////////////////
 
     iterator erase(const_iterator pos) {
-      pos.it->p->n = pos.it->n;
-      pos.it->n->p = pos.it->p;
-      pos.it->n = nullptr;
-      pos.it->p = nullptr;
-      cell *todel = pos.it;
-      ++pos;
-      delete todel;
-      return pos;
+      PHUNDRAK_PERF_SCOPE("list::erase");
+      return iterator{unlink(pos.it)};
     }
 
     iterator erase(const_iterator begin, const_iterator end) {
-      while (begin != end) {
-        begin = erase(begin);
-      }
-      return begin;
+      cell *it = begin.it;
+      while (it != end.it)
+        it = unlink(it);
+      return iterator{it};
     }
 
     // push_back ////////////////////////////////////////////////////////////////
 
+    //! push_back() and push_front() may run compact(), see auto_compact().
     void push_back(const T &v) {
-      cell *c = new cell;
-      c->x = v;
-      c->p = sentry->p;
-      c->n = sentry;
-      sentry->p->n = c;
-      sentry->p = c;
+      PHUNDRAK_PERF_SCOPE("list::push_back");
+      link_before(sentry, make_cell(v));
+      maybe_compact();
     }
 
     void push_back(T &&v) {
-      cell *c = new cell;
-      std::swap(c->x, v);
-      c->p = sentry->p;
-      c->n = sentry;
-      sentry->p->n = c;
-      sentry->p = c;
+      PHUNDRAK_PERF_SCOPE("list::push_back");
+      link_before(sentry, make_cell(std::move(v)));
+      maybe_compact();
     }
 
     // emplace_back /////////////////////////////////////////////////////////////
 
     template <class... Args> T &emplace_back(Args &&... args) {
-      emplace(begin(), args...);
-      return *begin();
+      return *emplace(end(), std::forward<Args>(args)...);
     }
 
     // pop_back /////////////////////////////////////////////////////////////////
 
-    void pop_back() {
-      cell *c = sentry->p;
-      sentry->p = c->p;
-      c->p->n = sentry;
-      delete c;
-    }
+    void pop_back() { unlink(sentry->p); }
 
     // push_front ///////////////////////////////////////////////////////////////
 
     void push_front(const T &v) {
-      cell *c = new cell;
-      c->x = v;
-      c->n = sentry->n;
-      c->p = sentry;
-      sentry->n->p = c;
-      sentry->n = c;
+      PHUNDRAK_PERF_SCOPE("list::push_front");
+      link_before(sentry->n, make_cell(v));
+      maybe_compact();
     }
 
     void push_front(T &&value) {
-      cell *c = new cell;
-      std::swap(c->x, value);
-      c->n = sentry->n;
-      c->p = sentry;
-      sentry->n->p = c;
-      sentry->p = c;
+      PHUNDRAK_PERF_SCOPE("list::push_front");
+      link_before(sentry->n, make_cell(std::move(value)));
+      maybe_compact();
     }
 
     // emplace_front ////////////////////////////////////////////////////////////
 
     template <class... Args> T &emplace_front(Args &&... args) {
-      emplace(end(), args...);
-      return *end();
+      return *emplace(begin(), std::forward<Args>(args)...);
     }
 
     // pop_front ////////////////////////////////////////////////////////////////
 
-    void pop_front() {
-      cell *c = sentry->n;
-      sentry->n = c->n;
-      c->n->p = sentry;
-      delete c;
-    }
+    void pop_front() { unlink(sentry->n); }
 
     // resize ///////////////////////////////////////////////////////////////////
 
     void resize(size_type count) {
       if (count > size())
-        while (size() < count)
-          push_back(T());
+        link_chain(sentry, make_chain_n(count - size()));
       else
         while (size() > count)
           pop_back();
@@ -376,8 +586,7 @@ namespace phundrak {
 
     void resize(size_type count, const T &value) {
       if (count > size())
-        while (size() < count)
-          push_back(value);
+        link_chain(sentry, make_chain_n(count - size(), value));
       else
         while (size() > count)
           pop_back();
@@ -390,11 +599,21 @@ namespace phundrak {
         if (get_allocator() != other.get_allocator())
           throw 20;
       } catch (int e) {
-        std::cout << "An error has occured: " << this << " and " << *other
+        std::cout << "An error has occured: " << this << " and " << &other
                   << " do not have the same allocator.\nAborting...\n";
         std::terminate();
       }
       std::swap(other.sentry, sentry);
+      std::swap(other.size_, size_);
+      std::swap(other.free_cells_, free_cells_);
+      std::swap(other.bump_block_, bump_block_);
+      std::swap(other.bump_, bump_);
+      std::swap(other.bump_end_, bump_end_);
+      std::swap(other.next_page_, next_page_);
+      std::swap(other.last_page_, last_page_);
+      std::swap(other.block_pages_, block_pages_);
+      std::swap(other.churn_, churn_);
+      std::swap(other.auto_compact_, auto_compact_);
     }
 
     /////////////////////////////////////////////////////////////////////////////
@@ -403,89 +622,59 @@ namespace phundrak {
 
     // merge ////////////////////////////////////////////////////////////////////
 
+    //! Merge other, sorted, into this list, sorted, leaving other empty. Runs
+    //! of other that go before the same element are relinked at once, and
+    //! equal elements of this list stay first; no element is copied.
     void merge(list &other) {
-      if (this == other)
-        return;
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout << "Error in void List<T>::merge(list& other): " << this
-                  << " and " << *other << " do not share the same allocator.\n";
-      }
-      sentry->p->n = other.sentry->n;
-      other.sentry->n->p = sentry->p;
-      other.sentry->p->n = sentry;
-      sentry->p = other.sentry->p;
-      other.sentry->n = other.sentry;
-      other.sentry->p = other.sentry;
-      std::sort(*this);
+      merge(other, [](const T &a, const T &b) { return a < b; });
     }
 
-    void merge(list &&other) {
-      if (this == other)
-        return;
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout << "Error in void List<T>::merge(list &&other):\n"
-                  << this << " and " << *other
-                  << " do not share the same allocator.\n";
-      }
-      sentry->p->n = other.sentry->n;
-      other.sentry->n->p = sentry->p;
-      other.sentry->p->n = sentry;
-      sentry->p = other.sentry->p;
-      other.sentry->n = other.sentry;
-      other.sentry->p = other.sentry;
-      std::sort(*this);
-    }
+    void merge(list &&other) { merge(other); }
 
     template <class Compare> void merge(list &other, Compare comp) {
-      if (this == other)
-        return;
       try {
         if (get_allocator() != other.get_allocator())
           throw 20;
       } catch (int error) {
-        std::cout << "Error in template <class Compare> void List<T>::merge(list "
-          "&other, Compare comp):\n"
-                  << this << " and " << *other
-                  << " do not share the same allocator.\n";
+        std::cout
+          << "Error in void List<T>::merge(list& other, Compare comp):\n"
+          << this << " and " << &other << " do not share the same allocator.\n";
+      }
+      if (&other == this)
+        return;
+      cell *it = sentry->n;
+      cell *first = other.sentry->n;
+      while (first != other.sentry) {
+        if (it == sentry) {
+          transfer(sentry, first, other.sentry);
+          break;
+        }
+        if (!comp(static_cast<const T &>(first->x),
+                  static_cast<const T &>(it->x))) {
+          it = it->n;
+          continue;
+        }
+        cell *last = first->n;
+        while (last != other.sentry &&
+               comp(static_cast<const T &>(last->x),
+                    static_cast<const T &>(it->x)))
+          last = last->n;
+        transfer(it, first, last);
+        first = last;
       }
-      sentry->p->n = other.sentry->n;
-      other.sentry->n->p = sentry->p;
-      other.sentry->p->n = sentry;
-      sentry->p = other.sentry->p;
-      other.sentry->n = other.sentry;
-      other.sentry->p = other.sentry;
-      std::sort(*this, comp);
+      size_ += other.size_;
+      other.size_ = 0;
     }
 
     template <class Compare> void merge(list &&other, Compare comp) {
-      if (this == other)
-        return;
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout << "Error in template<class Compare> void "
-          "List<T>::merge(list&& other, Compare comp):\n"
-                  << this << " and " << *other
-                  << " do not share the same allocator.\n";
-      }
-      sentry->p->n = other.sentry->n;
-      other.sentry->n->p = sentry->p;
-      other.sentry->p->n = sentry;
-      sentry->p = other.sentry->p;
-      other.sentry->n = other.sentry;
-      other.sentry->p = other.sentry;
-      std::sort(*this, comp);
+      merge(other, comp);
     }
 
     // splice ///////////////////////////////////////////////////////////////////
 
+    //! Move every element of other before pos. Only links are rewritten:
+    //! iterators and references to the moved elements stay valid and now
+    //! refer into this list.
     void splice(const_iterator pos, list &other) {
       try {
         if (get_allocator() != other.get_allocator())
@@ -493,33 +682,18 @@ namespace phundrak {
       } catch (int error) {
         std::cout
           << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
+          << this << " and " << &other << " do not share the same allocator.\n";
       }
-      pos->p->n = other.sentry->n;
-      other.sentry->p->n = pos;
-      other.sentry->n->p = pos->p;
-      pos->p = other.sentry->p;
-      other.sentry->p = other.sentry;
-      other.sentry->n = other.sentry;
+      if (&other == this || other.empty())
+        return;
+      transfer(pos.it, other.sentry->n, other.sentry);
+      size_ += other.size_;
+      other.size_ = 0;
     }
 
-    void splice(const_iterator pos, list &&other) {
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout
-          << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
-      }
-      pos->p->n = other.sentry->n;
-      other.sentry->p->n = pos;
-      other.sentry->n->p = pos->p;
-      pos->p = other.sentry->p;
-      other.sentry->p = other.sentry;
-      other.sentry->n = other.sentry;
-    }
+    void splice(const_iterator pos, list &&other) { splice(pos, other); }
 
+    //! Move the element at it, from other or from this list, before pos.
     void splice(const_iterator pos, list &other, const_iterator it) {
       try {
         if (get_allocator() != other.get_allocator())
@@ -527,35 +701,22 @@ namespace phundrak {
       } catch (int error) {
         std::cout
           << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
+          << this << " and " << &other << " do not share the same allocator.\n";
       }
-
-      it->p->n = it->n;
-      it->n->p = it->p;
-      it->p = it->p;
-      it->n = pos;
-      pos->p->n = it;
-      pos->p = it;
+      if (pos.it == it.it || pos.it == it.it->n)
+        return;
+      transfer(pos.it, it.it, it.it->n);
+      ++size_;
+      --other.size_;
     }
 
     void splice(const_iterator pos, list &&other, const_iterator it) {
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout
-          << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
-      }
-
-      it->p->n = it->n;
-      it->n->p = it->p;
-      it->p = it->p;
-      it->n = pos;
-      pos->p->n = it;
-      pos->p = it;
+      splice(pos, other, it);
     }
 
+    //! Move [first, last) before pos, which must not be in that range. Linear
+    //! in the length of the range when other is another list, to keep both
+    //! sizes exact.
     void splice(const_iterator pos, list &other, const_iterator first,
                 const_iterator last) {
       try {
@@ -564,93 +725,145 @@ namespace phundrak {
       } catch (int error) {
         std::cout
           << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
+          << this << " and " << &other << " do not share the same allocator.\n";
       }
-
-      first->p->n = last;
-      pos->p->n = first;
-      last->p->n = pos;
-      auto cell = last->p;
-      last->p = first->p;
-      first->p = pos->n;
-      pos->n = cell;
+      if (&other != this) {
+        size_type moved = 0;
+        for (cell *it = first.it; it != last.it; it = it->n)
+          ++moved;
+        size_ += moved;
+        other.size_ -= moved;
+      }
+      transfer(pos.it, first.it, last.it);
     }
 
     void splice(const_iterator pos, list &&other, const_iterator first,
                 const_iterator last) {
-      try {
-        if (get_allocator() != other.get_allocator())
-          throw 20;
-      } catch (int error) {
-        std::cout
-          << "Error in void List<T>::splice(const_iterator pos, list& other):\n"
-          << this << " and " << *other << " do not share the same allocator.\n";
-      }
-
-      first->p->n = last;
-      pos->p->n = first;
-      last->p->n = pos;
-      auto cell = last->p;
-      last->p = first->p;
-      first->p = pos->n;
-      pos->n = cell;
+      splice(pos, other, first, last);
     }
 
     // remove, remove_if ////////////////////////////////////////////////////////
 
     void remove(const T &value) {
-      for (auto itr = begin(); itr != end(); ++itr)
-        if (itr->x == value) {
-          auto elem = itr;
-          --itr;
-          elem->p->n = elem->n;
-          elem->n->p = elem->p;
-          elem->n = nullptr;
-          elem->p = nullptr;
-          delete elem;
-        }
+      for (cell *it = sentry->n; it != sentry;)
+        it = it->x == value ? unlink(it) : it->n;
     }
 
-    template <class UnaryPredicate> void remove(UnaryPredicate p) {
-      for (auto itr = begin(); itr != end(); ++itr) {
-        if (p(*itr)) {
-          auto elem = itr;
-          --itr;
-          elem->p->n = elem->n;
-          elem->n->p = elem->p;
-          elem->n = nullptr;
-          elem->p = nullptr;
-          delete elem;
-        }
-      }
+    template <class UnaryPredicate> void remove_if(UnaryPredicate p) {
+      for (cell *it = sentry->n; it != sentry;)
+        it = p(it->x) ? unlink(it) : it->n;
     }
 
     // reverse //////////////////////////////////////////////////////////////////
 
     void reverse() noexcept {
-      list<T> list{};
-      while (sentry->n != sentry) {
-        sentry->n->p = list.sentry->p;
-        list.sentry->p->n = sentry->n;
-        sentry->n->n->p = sentry;
-        list.sentry->p = sentry->n;
-        sentry->n = sentry->n->n;
-        list.sentry->p->n = list.sentry;
+      cell *it = sentry;
+      do {
+        std::swap(it->p, it->n);
+        it = it->p;
+      } while (it != sentry);
+    }
+
+    /////////////////////////////////////////////////////////////////////////////
+    //                                 Locality                                //
+    /////////////////////////////////////////////////////////////////////////////
+
+    // compact //////////////////////////////////////////////////////////////////
+
+    //! Move the elements into freshly allocated, contiguous cells laid out in
+    //! list order, so that iterating afterwards walks memory sequentially.
+    //! Each element is moved exactly once, then its old cell is destroyed;
+    //! blocks left empty by the move are freed. If a move throws, the list
+    //! stays valid with its elements partly relocated.
+    //!
+    //! Invalidates every iterator, pointer and reference to the elements;
+    //! only end() stays valid.
+    void compact() {
+      PHUNDRAK_PERF_SCOPE("list::compact");
+      drop_free_cells();
+      churn_ = 0;
+      if (empty())
+        return;
+      // start a new block, large enough for the whole list if allowed,
+      // rather than fill the old one
+      bump_ = bump_end_;
+      next_page_ = last_page_;
+      while (block_pages_ < max_block_pages &&
+             block_pages_ * cells_per_page < size_)
+        block_pages_ *= 2;
+      for (cell *it = sentry->n; it != sentry;) {
+        cell *next = it->n;
+        cell *fresh = make_cell(std::move(it->x));
+        fresh->p = it->p;
+        fresh->n = next;
+        it->p->n = fresh;
+        next->p = fresh;
+        it->~cell();
+        unref_block(block_of(it));
+        it = next;
+      }
+    }
+
+    //! Let push_back() and push_front() call compact() once at least
+    //! churn_threshold elements, and at least as many as the list holds,
+    //! were erased since the last compaction; 0, the default, disables it.
+    //! Meant for long-lived lists under insert/erase churn: with it, any
+    //! push_back() or push_front() may invalidate iterators.
+    void auto_compact(size_type churn_threshold) noexcept {
+      auto_compact_ = churn_threshold;
+    }
+
+    // for_each_prefetched //////////////////////////////////////////////////////
+
+    //! Call f on every element in order while prefetching the cell `distance`
+    //! links ahead, for lists that are scattered but cannot be compacted.
+    //! Reaching the cell ahead is still a pointer chase, but it runs ahead of
+    //! f so that the cache misses of upcoming cells overlap with its work.
+    template <class UnaryFunction>
+    void for_each_prefetched(UnaryFunction f, size_type distance = 8) {
+      cell *ahead = sentry->n;
+      for (size_type i = 0; i < distance && ahead != sentry; ++i)
+        ahead = ahead->n;
+      for (cell *it = sentry->n; it != sentry; it = it->n) {
+        if (ahead != sentry) {
+          __builtin_prefetch(ahead->n);
+          ahead = ahead->n;
+        }
+        f(it->x);
+      }
+    }
+
+    template <class UnaryFunction>
+    void for_each_prefetched(UnaryFunction f, size_type distance = 8) const {
+      const cell *ahead = sentry->n;
+      for (size_type i = 0; i < distance && ahead != sentry; ++i)
+        ahead = ahead->n;
+      for (const cell *it = sentry->n; it != sentry; it = it->n) {
+        if (ahead != sentry) {
+          __builtin_prefetch(ahead->n);
+          ahead = ahead->n;
+        }
+        f(static_cast<const T &>(it->x));
       }
     }
 
     // unique ///////////////////////////////////////////////////////////////////
 
     void unique() {
-      for (auto elem = sentry->n; elem->n != sentry; elem = elem->n)
-        while (elem->x == elem->n->x)
-          erase(const_iterator{elem->n});
+      unique([](const T &a, const T &b) { return a == b; });
     }
 
+    //! Remove every element for which p(kept, element) holds, kept being the
+    //! last element left before it. The sentry is never compared.
     template <class BinaryPredicate> void unique(BinaryPredicate p) {
-      for (auto elem = sentry->n; elem->n != sentry; elem = elem->n)
-        while (p(elem, elem->n))
-          erase(iterator{elem->n});
+      cell *elem = sentry->n;
+      while (elem != sentry && elem->n != sentry) {
+        if (p(static_cast<const T &>(elem->x),
+              static_cast<const T &>(elem->n->x)))
+          unlink(elem->n);
+        else
+          elem = elem->n;
+      }
     }
 
     /////////////////////////////////////////////////////////////////////////////
@@ -668,7 +881,7 @@ namespace phundrak {
 
       iterator(const iterator &other) : it{other.it} {}
 
-      iterator(iterator &&other) { std::swap(it, other.it); }
+      iterator(iterator &&other) : it{other.it} {}
 
       iterator &operator=(cell *point) {
         it = point;
@@ -708,19 +921,18 @@ namespace phundrak {
         // iterator t;
         // t.it = it;
         iterator t{it};
-        it = it->n;
+        it = it->p;
         return t;
       }
 
-      bool operator==(cell *point) { return point == it; }
-      bool operator==(const iterator &other) { return other.it == it; }
-      bool operator==(iterator &&other) { return other.it == it; }
+      bool operator==(cell *point) const { return point == it; }
+      bool operator==(const iterator &other) const { return other.it == it; }
 
-      bool operator!=(cell *point) { return point != it; }
-      bool operator!=(const iterator &other) { return other.it != it; }
-      bool operator!=(iterator &&other) { return other.it != it; }
+      bool operator!=(cell *point) const { return point != it; }
+      bool operator!=(const iterator &other) const { return other.it != it; }
 
-      T &operator*() { return it->x; }
+      T &operator*() const { return it->x; }
+      T *operator->() const { return &it->x; }
 
       friend class list;
     };
@@ -729,12 +941,14 @@ namespace phundrak {
     public:
       const_iterator() : iterator() {}
       explicit const_iterator(cell *point) : iterator{point} {}
-      explicit const_iterator(const iterator &other) : iterator{other} {}
+      const_iterator(const iterator &other) : iterator{other} {}
       const_iterator(const const_iterator &other) : iterator{other} {}
-      explicit const_iterator(iterator &&other) : iterator{std::move(other)} {}
+      const_iterator(iterator &&other) : iterator{std::move(other)} {}
       const_iterator(const_iterator &&other) : iterator{std::move(other)} {}
+      const_iterator &operator=(const const_iterator &other) = default;
 
-      const T &operator*() { return this->it->x; }
+      const T &operator*() const { return this->it->x; }
+      const T *operator->() const { return &this->it->x; }
     };
 
     class reverse_iterator : public iterator {
@@ -0,0 +1,549 @@
+#pragma once
+
+#include "list.hh"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Default cache weigher: capacity counts entries.
+struct unit_weight {
+  template <class K, class V>
+  size_type operator()(const K &, const V &) const noexcept {
+    return 1;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 lru_cache                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Key-value cache evicting the least recently used entries.
+//!
+//! Entries live in a phundrak::list from most to least recently used, and an
+//! unordered_map indexes them by key; get() and put() splice the entry to the
+//! front in O(1). The capacity bounds the total weight of the entries, as
+//! computed by Weigher: one per entry by default, or for instance a byte
+//! count. The eviction callback, if any, sees every entry evicted to make
+//! room, before it is dropped.
+//!
+//! When an insertion evicts, the list cell and the hash node of the last
+//! evicted entry are reused for the new one, so a full cache reaches a
+//! steady state where put() does not allocate, as long as the key and value
+//! types do not allocate themselves on assignment.
+template <class K, class V, class Weigher = unit_weight,
+          class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+class lru_cache {
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using evict_callback = std::function<void(const K &, V &)>;
+
+private:
+  struct entry {
+    entry(const K &k, V v, size_type w)
+        : key{k}, value{std::move(v)}, weight{w} {}
+    K key;
+    V value;
+    size_type weight;
+  };
+
+  using entries_type = list<entry>;
+  using entry_iterator = typename entries_type::iterator;
+  using map_type =
+      std::unordered_map<K, entry_iterator, Hash, KeyEqual>;
+
+  entry_iterator last_entry() {
+    entry_iterator it = entries_.end();
+    return --it;
+  }
+
+  void touch(entry_iterator it) {
+    entries_.splice(entries_.begin(), entries_, it);
+  }
+
+  void evict_last() {
+    entry_iterator it = last_entry();
+    entry &e = *it;
+    if (on_evict_)
+      on_evict_(e.key, e.value);
+    weight_ -= e.weight;
+    map_.erase(e.key);
+    entries_.pop_back();
+  }
+
+  void trim() {
+    while (weight_ > capacity_ && !entries_.empty())
+      evict_last();
+  }
+
+  entries_type entries_; // most recently used first
+  map_type map_;
+  size_type capacity_;
+  size_type weight_;
+  Weigher weigher_;
+  evict_callback on_evict_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  explicit lru_cache(size_type capacity, Weigher weigher = Weigher())
+      : entries_{}, map_{}, capacity_{capacity}, weight_{0},
+        weigher_{std::move(weigher)}, on_evict_{} {}
+
+  lru_cache(const lru_cache &) = delete;
+  lru_cache &operator=(const lru_cache &) = delete;
+
+  //! Called with every entry evicted to make room.
+  void on_evict(evict_callback callback) { on_evict_ = std::move(callback); }
+
+  // Lookup /////////////////////////////////////////////////////////////////
+
+  //! The value of key, now the most recently used, or nullptr. The pointer
+  //! stays valid until the entry is evicted or erased.
+  V *get(const K &key) {
+    auto found = map_.find(key);
+    if (found == map_.end())
+      return nullptr;
+    touch(found->second);
+    return &found->second->value;
+  }
+
+  //! The value of key without changing its recency, or nullptr.
+  const V *peek(const K &key) const {
+    auto found = map_.find(key);
+    return found == map_.end() ? nullptr : &found->second->value;
+  }
+
+  bool contains(const K &key) const { return map_.count(key) != 0; }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return entries_.empty(); }
+  size_type size() const noexcept { return entries_.size(); }
+  size_type weight() const noexcept { return weight_; }
+  size_type capacity() const noexcept { return capacity_; }
+
+  //! Change the capacity, evicting entries if it shrinks.
+  void set_capacity(size_type capacity) {
+    capacity_ = capacity;
+    trim();
+  }
+
+  //! Size the hash index for `count` entries up front.
+  void reserve(size_type count) { map_.reserve(count); }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  //! Insert or replace the value of key and make it the most recently used.
+  //! Returns false, storing nothing, if its weight alone exceeds capacity.
+  bool put(const K &key, V value) {
+    size_type w = weigher_(key, value);
+    auto found = map_.find(key);
+    if (found != map_.end()) {
+      if (w > capacity_) {
+        erase(key);
+        return false;
+      }
+      entry &e = *found->second;
+      weight_ = weight_ - e.weight + w;
+      e.value = std::move(value);
+      e.weight = w;
+      touch(found->second);
+      trim();
+      return true;
+    }
+    if (w > capacity_)
+      return false;
+    while (weight_ + w > capacity_) {
+      if (weight_ - last_entry()->weight + w > capacity_) {
+        evict_last();
+        continue;
+      }
+      // this eviction makes room: recycle the entry's cell and hash node
+      entry_iterator it = last_entry();
+      entry &e = *it;
+      if (on_evict_)
+        on_evict_(e.key, e.value);
+      auto node = map_.extract(e.key);
+      weight_ = weight_ - e.weight + w;
+      e.key = key;
+      e.value = std::move(value);
+      e.weight = w;
+      touch(it);
+      node.key() = key;
+      node.mapped() = it;
+      map_.insert(std::move(node));
+      return true;
+    }
+    entries_.emplace_front(key, std::move(value), w);
+    map_.emplace(key, entries_.begin());
+    weight_ += w;
+    return true;
+  }
+
+  //! Remove key without calling the eviction callback.
+  bool erase(const K &key) {
+    auto found = map_.find(key);
+    if (found == map_.end())
+      return false;
+    weight_ -= found->second->weight;
+    entries_.erase(found->second);
+    map_.erase(found);
+    return true;
+  }
+
+  void clear() {
+    map_.clear();
+    entries_.clear();
+    weight_ = 0;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                 lfu_cache                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Key-value cache evicting the least frequently used entries, the least
+//! recently used first among equally frequent ones.
+//!
+//! Entries live in a single list sorted by access count, from the least to
+//! the most frequent, and by recency within each run of equal counts. A
+//! second index maps every count present to the last entry of its run, so
+//! that an access moves its entry to the end of the next run with one
+//! splice: get(), put() and eviction are all O(1). Capacity, weigher,
+//! callback and the recycling of evicted entries work as in lru_cache.
+template <class K, class V, class Weigher = unit_weight,
+          class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+class lfu_cache {
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using evict_callback = std::function<void(const K &, V &)>;
+
+private:
+  struct entry {
+    entry(const K &k, V v, size_type w)
+        : key{k}, value{std::move(v)}, weight{w}, uses{1} {}
+    K key;
+    V value;
+    size_type weight;
+    size_type uses;
+  };
+
+  using entries_type = list<entry>;
+  using entry_iterator = typename entries_type::iterator;
+  using map_type =
+      std::unordered_map<K, entry_iterator, Hash, KeyEqual>;
+  using runs_type = std::unordered_map<size_type, entry_iterator>;
+
+  static entry_iterator next(entry_iterator it) { return ++it; }
+  static entry_iterator prev(entry_iterator it) { return --it; }
+
+  //! Runs appear and vanish as entries are used; the hash node of the last
+  //! vanished run is kept for the next new one, so that this churn does not
+  //! allocate.
+  void set_run_tail(size_type uses, entry_iterator it) {
+    auto run = runs_.find(uses);
+    if (run != runs_.end()) {
+      run->second = it;
+    } else if (spare_run_.empty()) {
+      runs_.emplace(uses, it);
+    } else {
+      spare_run_.key() = uses;
+      spare_run_.mapped() = it;
+      runs_.insert(std::move(spare_run_));
+    }
+  }
+
+  void drop_run(typename runs_type::iterator run) {
+    if (spare_run_.empty())
+      spare_run_ = runs_.extract(run);
+    else
+      runs_.erase(run);
+  }
+
+  //! it is about to leave its run: fix the run's tail.
+  void leave_run(entry_iterator it) {
+    auto run = runs_.find(it->uses);
+    if (run->second != it)
+      return;
+    if (it != entries_.begin() && prev(it)->uses == it->uses)
+      run->second = prev(it);
+    else
+      drop_run(run);
+  }
+
+  //! Count one more use of it and move it to the end of its new run.
+  void touch(entry_iterator it) {
+    auto next_run = runs_.find(it->uses + 1);
+    entry_iterator pos = next(next_run != runs_.end()
+                                  ? next_run->second
+                                  : runs_.find(it->uses)->second);
+    leave_run(it);
+    entries_.splice(pos, entries_, it);
+    ++it->uses;
+    set_run_tail(it->uses, it);
+  }
+
+  //! Link a fresh entry, with one use, at the end of the first run.
+  void place_new(entry_iterator it) {
+    auto first_run = runs_.find(1);
+    entry_iterator pos = first_run != runs_.end() ? next(first_run->second)
+                                                  : entries_.begin();
+    entries_.splice(pos, entries_, it);
+    set_run_tail(1, it);
+  }
+
+  void evict_first() {
+    entry_iterator it = entries_.begin();
+    if (on_evict_)
+      on_evict_(it->key, it->value);
+    weight_ -= it->weight;
+    leave_run(it);
+    map_.erase(it->key);
+    entries_.pop_front();
+  }
+
+  void trim() {
+    while (weight_ > capacity_ && !entries_.empty())
+      evict_first();
+  }
+
+  entries_type entries_; // least frequently used first
+  map_type map_;
+  runs_type runs_; // use count -> last entry with that count
+  typename runs_type::node_type spare_run_;
+  size_type capacity_;
+  size_type weight_;
+  Weigher weigher_;
+  evict_callback on_evict_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  explicit lfu_cache(size_type capacity, Weigher weigher = Weigher())
+      : entries_{}, map_{}, runs_{}, spare_run_{}, capacity_{capacity},
+        weight_{0}, weigher_{std::move(weigher)}, on_evict_{} {}
+
+  lfu_cache(const lfu_cache &) = delete;
+  lfu_cache &operator=(const lfu_cache &) = delete;
+
+  void on_evict(evict_callback callback) { on_evict_ = std::move(callback); }
+
+  // Lookup /////////////////////////////////////////////////////////////////
+
+  //! The value of key, counting one use of it, or nullptr.
+  V *get(const K &key) {
+    auto found = map_.find(key);
+    if (found == map_.end())
+      return nullptr;
+    touch(found->second);
+    return &found->second->value;
+  }
+
+  const V *peek(const K &key) const {
+    auto found = map_.find(key);
+    return found == map_.end() ? nullptr : &found->second->value;
+  }
+
+  bool contains(const K &key) const { return map_.count(key) != 0; }
+
+  //! How many times key was put or got, 0 if absent.
+  size_type uses(const K &key) const {
+    auto found = map_.find(key);
+    return found == map_.end() ? 0 : found->second->uses;
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return entries_.empty(); }
+  size_type size() const noexcept { return entries_.size(); }
+  size_type weight() const noexcept { return weight_; }
+  size_type capacity() const noexcept { return capacity_; }
+
+  void set_capacity(size_type capacity) {
+    capacity_ = capacity;
+    trim();
+  }
+
+  void reserve(size_type count) {
+    map_.reserve(count);
+    runs_.reserve(count);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  //! Insert key with one use, or replace its value and count one more use.
+  //! Returns false, storing nothing, if its weight alone exceeds capacity.
+  bool put(const K &key, V value) {
+    size_type w = weigher_(key, value);
+    auto found = map_.find(key);
+    if (found != map_.end()) {
+      if (w > capacity_) {
+        erase(key);
+        return false;
+      }
+      entry &e = *found->second;
+      weight_ = weight_ - e.weight + w;
+      e.value = std::move(value);
+      e.weight = w;
+      touch(found->second);
+      trim();
+      return true;
+    }
+    if (w > capacity_)
+      return false;
+    while (weight_ + w > capacity_) {
+      entry_iterator it = entries_.begin();
+      if (weight_ - it->weight + w > capacity_) {
+        evict_first();
+        continue;
+      }
+      // this eviction makes room: recycle the entry's cell and hash node
+      if (on_evict_)
+        on_evict_(it->key, it->value);
+      leave_run(it);
+      auto node = map_.extract(it->key);
+      weight_ = weight_ - it->weight + w;
+      it->key = key;
+      it->value = std::move(value);
+      it->weight = w;
+      it->uses = 1;
+      place_new(it);
+      node.key() = key;
+      node.mapped() = it;
+      map_.insert(std::move(node));
+      return true;
+    }
+    entries_.emplace_front(key, std::move(value), w);
+    entry_iterator it = entries_.begin();
+    place_new(it);
+    map_.emplace(key, it);
+    weight_ += w;
+    return true;
+  }
+
+  //! Remove key without calling the eviction callback.
+  bool erase(const K &key) {
+    auto found = map_.find(key);
+    if (found == map_.end())
+      return false;
+    entry_iterator it = found->second;
+    weight_ -= it->weight;
+    leave_run(it);
+    map_.erase(found);
+    entries_.erase(it);
+    return true;
+  }
+
+  void clear() {
+    map_.clear();
+    runs_.clear();
+    entries_.clear();
+    weight_ = 0;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               sharded_cache                               //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Thread-safe wrapper around Shards independent caches, each behind its
+//! own mutex, so that threads working on different keys rarely contend.
+//! Keys are spread over the shards by hash, and the capacity is split
+//! evenly between them. Lookups return copies, since a pointer into a
+//! shard would not survive the release of its lock.
+template <class Cache, size_type Shards = 16,
+          class Hash = std::hash<typename Cache::key_type>>
+class sharded_cache {
+  using K = typename Cache::key_type;
+  using V = typename Cache::mapped_type;
+
+  struct shard {
+    template <class... Args>
+    explicit shard(Args &&... args)
+        : lock{}, cache{std::forward<Args>(args)...} {}
+    std::mutex lock;
+    Cache cache;
+  };
+
+  shard &shard_of(const K &key) {
+    // the low bits may also index the shard's own buckets: mix them first
+    std::uint64_t h = static_cast<std::uint64_t>(Hash{}(key));
+    h *= 0x9E3779B97F4A7C15ULL;
+    return *shards_[static_cast<size_type>(h >> 32) % Shards];
+  }
+
+  std::unique_ptr<shard> shards_[Shards];
+
+public:
+  //! capacity is the total for all shards; extra arguments, such as a
+  //! weigher, are passed to every shard's cache.
+  template <class... Args>
+  explicit sharded_cache(size_type capacity, const Args &... args)
+      : shards_{} {
+    for (size_type i = 0; i < Shards; ++i)
+      shards_[i] = std::make_unique<shard>(
+          capacity / Shards + (i < capacity % Shards ? 1 : 0), args...);
+  }
+
+  std::optional<V> get(const K &key) {
+    shard &s = shard_of(key);
+    std::lock_guard<std::mutex> guard{s.lock};
+    if (V *v = s.cache.get(key))
+      return *v;
+    return std::nullopt;
+  }
+
+  bool put(const K &key, V value) {
+    shard &s = shard_of(key);
+    std::lock_guard<std::mutex> guard{s.lock};
+    return s.cache.put(key, std::move(value));
+  }
+
+  bool erase(const K &key) {
+    shard &s = shard_of(key);
+    std::lock_guard<std::mutex> guard{s.lock};
+    return s.cache.erase(key);
+  }
+
+  //! Install the same callback in every shard; it runs under a shard lock
+  //! and must not call back into this cache.
+  void on_evict(typename Cache::evict_callback callback) {
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> guard{s->lock};
+      s->cache.on_evict(callback);
+    }
+  }
+
+  //! Number of entries; shards are counted one after the other, so the
+  //! total is only exact if no other thread is modifying the cache.
+  size_type size() {
+    size_type total = 0;
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> guard{s->lock};
+      total += s->cache.size();
+    }
+    return total;
+  }
+
+  void clear() {
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> guard{s->lock};
+      s->cache.clear();
+    }
+  }
+};
+
+} // namespace phundrak
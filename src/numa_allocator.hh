@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <new>
+#include <type_traits>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Where the pages of a numa_allocator allocation are placed.
+enum class numa_policy {
+  local,      //!< on the node of the thread that first touches each page
+  interleave, //!< round-robin over every online node
+  bind        //!< on one given node
+};
+
+//! Allocator for large, bandwidth-bound buffers on NUMA machines.
+//!
+//! Allocations of at least mmap_threshold bytes get their own anonymous
+//! mapping, starting on a 2 MiB boundary and rounded up to a whole number of
+//! 2 MiB huge pages, and optionally marked for transparent huge pages with
+//! madvise(). The placement policy is applied with mbind() before any page
+//! is touched. With the local policy, pages land where they are first
+//! written: fill the buffer with the threads that will process it, see
+//! vector::first_touch_resize(). Smaller allocations go to operator new.
+//!
+//! Placement and huge pages are hints: if the kernel refuses them, the
+//! memory is still valid and simply placed by the default policy.
+template <class T> class numa_allocator {
+public:
+  using value_type = T;
+  using size_type = phundrak::size_type;
+  using difference_type = std::ptrdiff_t;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  static constexpr size_type huge_page_size = size_type{1} << 21;
+
+  numa_allocator() noexcept
+      : policy_{numa_policy::local}, node_{0}, huge_pages_{true},
+        mmap_threshold_{huge_page_size} {}
+
+  explicit numa_allocator(numa_policy policy, int node = 0,
+                          bool huge_pages = true,
+                          size_type mmap_threshold = huge_page_size) noexcept
+      : policy_{policy}, node_{node}, huge_pages_{huge_pages},
+        mmap_threshold_{mmap_threshold} {}
+
+  template <class U>
+  numa_allocator(const numa_allocator<U> &other) noexcept
+      : policy_{other.policy()}, node_{other.node()},
+        huge_pages_{other.huge_pages()},
+        mmap_threshold_{other.mmap_threshold()} {}
+
+  numa_policy policy() const noexcept { return policy_; }
+  int node() const noexcept { return node_; }
+  bool huge_pages() const noexcept { return huge_pages_; }
+  size_type mmap_threshold() const noexcept { return mmap_threshold_; }
+
+  T *allocate(size_type n) {
+    if (n > static_cast<size_type>(-1) / sizeof(T))
+      throw std::bad_array_new_length();
+    size_type bytes = n * sizeof(T);
+#if defined(__linux__)
+    if (bytes >= mmap_threshold_) {
+      size_type length = mapped_length(bytes);
+      void *p = map_aligned(length);
+      if (huge_pages_)
+        madvise(p, length, MADV_HUGEPAGE);
+      apply_policy(p, length);
+      return static_cast<T *>(p);
+    }
+#endif
+    return static_cast<T *>(
+        ::operator new(bytes, std::align_val_t{alignof(T)}));
+  }
+
+  void deallocate(T *p, size_type n) noexcept {
+    size_type bytes = n * sizeof(T);
+#if defined(__linux__)
+    if (bytes >= mmap_threshold_) {
+      munmap(p, mapped_length(bytes));
+      return;
+    }
+#endif
+    ::operator delete(p, std::align_val_t{alignof(T)});
+  }
+
+private:
+  static size_type mapped_length(size_type bytes) noexcept {
+    return (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+  }
+
+#if defined(__linux__)
+  //! length bytes, length a multiple of huge_page_size, mapped at a
+  //! huge_page_size boundary so that huge pages can back all of them: map
+  //! one huge page more than needed and unmap what sticks out on each side.
+  static void *map_aligned(size_type length) {
+    void *p = mmap(nullptr, length + huge_page_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    auto *first = static_cast<unsigned char *>(p);
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(p);
+    size_type head = (huge_page_size - address % huge_page_size) %
+                     huge_page_size;
+    if (head)
+      munmap(first, head);
+    munmap(first + head + length, huge_page_size - head);
+    return first + head;
+  }
+
+  //! Set of NUMA nodes in the layout mbind() expects.
+  struct node_set {
+    static constexpr int max_nodes = 1024;
+    static constexpr int word_bits = 8 * sizeof(unsigned long);
+
+    unsigned long words[max_nodes / word_bits] = {};
+    int highest = -1;
+
+    void add(int node) noexcept {
+      if (node < 0 || node >= max_nodes)
+        return;
+      words[node / word_bits] |= 1UL << (node % word_bits);
+      highest = std::max(highest, node);
+    }
+
+    bool contains(int node) const noexcept {
+      return node >= 0 && node <= highest &&
+             (words[node / word_bits] >> (node % word_bits) & 1UL);
+    }
+  };
+
+  //! Nodes listed in /sys/devices/system/node/online ("0-3,6"), read once;
+  //! empty if it cannot be read. Asking mbind() for nodes the kernel does
+  //! not know makes it fail with EINVAL.
+  static const node_set &online_nodes() noexcept {
+    static const node_set online = [] {
+      node_set nodes;
+      std::FILE *f = std::fopen("/sys/devices/system/node/online", "r");
+      if (!f)
+        return nodes;
+      int first = 0;
+      while (std::fscanf(f, "%d", &first) == 1) {
+        int last = first;
+        int c = std::fgetc(f);
+        if (c == '-') {
+          if (std::fscanf(f, "%d", &last) != 1)
+            break;
+          c = std::fgetc(f);
+        }
+        for (int node = first; node <= last; ++node)
+          nodes.add(node);
+        if (c != ',')
+          break;
+      }
+      std::fclose(f);
+      return nodes;
+    }();
+    return online;
+  }
+
+  //! mbind() through syscall(), so that libnuma is not needed.
+  void apply_policy(void *p, size_type length) const noexcept {
+    node_set nodes;
+    int mode = MPOL_LOCAL;
+    switch (policy_) {
+    case numa_policy::interleave:
+      mode = MPOL_INTERLEAVE;
+      nodes = online_nodes();
+      break;
+    case numa_policy::bind:
+      if (!online_nodes().contains(node_))
+        return;
+      mode = MPOL_BIND;
+      nodes.add(node_);
+      break;
+    case numa_policy::local:
+    default:
+      break;
+    }
+    if (mode != MPOL_LOCAL && nodes.highest < 0)
+      return; // topology unknown: keep the default policy
+    // the kernel reads maxnode - 1 bits of the mask; a refused policy
+    // leaves the default one in place
+    syscall(SYS_mbind, p, length, mode,
+            mode == MPOL_LOCAL ? nullptr : nodes.words,
+            mode == MPOL_LOCAL ? 0UL
+                               : static_cast<unsigned long>(nodes.highest) + 2,
+            0U);
+  }
+#endif
+
+  numa_policy policy_;
+  int node_;
+  bool huge_pages_;
+  size_type mmap_threshold_;
+};
+
+//! Two numa_allocators are equal when memory from one can be freed by the
+//! other, that is when they agree on which path a given size takes.
+template <class T, class U>
+bool operator==(const numa_allocator<T> &lhs,
+                const numa_allocator<U> &rhs) noexcept {
+  return lhs.mmap_threshold() == rhs.mmap_threshold();
+}
+
+template <class T, class U>
+bool operator!=(const numa_allocator<T> &lhs,
+                const numa_allocator<U> &rhs) noexcept {
+  return !(lhs == rhs);
+}
+
+} // namespace phundrak
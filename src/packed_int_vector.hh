@@ -0,0 +1,612 @@
+#pragma once
+
+#include "vector.hh"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+namespace packing {
+
+using word_type = std::uint64_t;
+constexpr unsigned word_bits = 64;
+
+inline size_type words_for(size_type bits) noexcept {
+  return (bits + word_bits - 1) / word_bits;
+}
+
+//! Lowest `width` bits set, for width in [0, 64].
+inline word_type mask(unsigned width) noexcept {
+  return width ? ~word_type{0} >> (word_bits - width) : 0;
+}
+
+//! Bits needed to store value, at least one.
+inline unsigned bits_for(word_type value) noexcept {
+  return value ? word_bits - static_cast<unsigned>(__builtin_clzll(value)) : 1;
+}
+
+//! The `width` bits at bit pos of w, masked by m = mask(width). Always
+//! reads w[pos / 64 + 1], which must exist: packed arrays keep a zero word
+//! past their end so that this needs no branch.
+inline word_type read(const word_type *w, size_type pos,
+                      word_type m) noexcept {
+  const size_type i = pos / word_bits;
+  const unsigned off = pos % word_bits;
+  // (x << 1) << (63 - off) rather than x << (64 - off), undefined for 0
+  return ((w[i] >> off) | ((w[i + 1] << 1) << (word_bits - 1 - off))) & m;
+}
+
+//! Store value, which fits in `width` bits, at bit pos of w.
+inline void write(word_type *w, size_type pos, unsigned width,
+                  word_type value) noexcept {
+  const size_type i = pos / word_bits;
+  const unsigned off = pos % word_bits;
+  const word_type m = mask(width);
+  w[i] = (w[i] & ~(m << off)) | (value << off);
+  if (off + width > word_bits) {
+    const unsigned shift = word_bits - off;
+    w[i + 1] = (w[i + 1] & ~(m >> shift)) | (value >> shift);
+  }
+}
+
+} // namespace packing
+
+///////////////////////////////////////////////////////////////////////////////
+//                             packed_int_vector                             //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Dynamic array of unsigned integers stored on width() bits each, packed
+//! back to back in 64-bit words, with O(1) random access.
+//!
+//! The width is either fixed at construction, and storing a wider value is
+//! an error, or automatic (width 0): the vector then starts at one bit and
+//! repacks itself whenever a wider value comes in, which happens at most
+//! once per bit of T.
+template <class T = std::uint64_t> class packed_int_vector {
+  static_assert(std::is_integral_v<T> && std::is_unsigned_v<T> &&
+                    sizeof(T) <= sizeof(packing::word_type),
+                "packed_int_vector stores unsigned integers");
+
+  using word_type = packing::word_type;
+
+  static constexpr unsigned max_width = sizeof(T) * 8;
+
+  void check_width(unsigned width) const {
+    try {
+      if (width > max_width)
+        throw std::length_error("Width too large");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << ": " << width
+                << " bits in phundrak::packed_int_vector " << this << '\n';
+      std::terminate();
+    }
+  }
+
+  //! Make room for value, widening if the width is automatic.
+  void fit(T value, const char *where) {
+    unsigned needed = packing::bits_for(value);
+    if (needed <= width_)
+      return;
+    try {
+      if (!auto_width_)
+        throw std::out_of_range("Value too wide");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << ": " << +value << " in "
+                << "phundrak::packed_int_vector::" << where << " of width "
+                << width_ << ' ' << this << '\n';
+      std::terminate();
+    }
+    repack(needed);
+  }
+
+  void repack(unsigned new_width) {
+    vector<word_type> words(packing::words_for(size_ * new_width) + 1,
+                            word_type{0});
+    for (size_type i = 0; i < size_; ++i)
+      packing::write(words.data(), i * new_width, new_width, get(i));
+    words_.swap(words);
+    width_ = new_width;
+    mask_ = packing::mask(new_width);
+  }
+
+  //! Words for count elements, plus the zero word read() relies on.
+  size_type words_needed(size_type count) const noexcept {
+    return packing::words_for(count * width_) + 1;
+  }
+
+  vector<word_type> words_;
+  size_type size_;
+  unsigned width_;
+  word_type mask_;
+  bool auto_width_;
+
+public:
+  class const_iterator;
+
+  using value_type = T;
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  //! Empty vector of the given width, automatic if 0.
+  explicit packed_int_vector(unsigned width = 0)
+      : words_(1, word_type{0}), size_{0}, width_{width ? width : 1},
+        mask_{packing::mask(width_)}, auto_width_{width == 0} {
+    check_width(width);
+  }
+
+  packed_int_vector(size_type count, T value, unsigned width = 0)
+      : packed_int_vector(width) {
+    resize(count, value);
+  }
+
+  //! Pack values; an automatic width is that of the largest one.
+  template <class A>
+  explicit packed_int_vector(const vector<T, A> &values, unsigned width = 0)
+      : packed_int_vector(width) {
+    T largest = 0;
+    for (size_type i = 0; auto_width_ && i < values.size(); ++i)
+      largest = std::max(largest, values[i]);
+    fit(largest, "packed_int_vector");
+    reserve(values.size());
+    for (size_type i = 0; i < values.size(); ++i)
+      push_back(values[i]);
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  T get(size_type pos) const noexcept {
+    return static_cast<T>(
+        packing::read(words_.data(), pos * width_, mask_));
+  }
+
+  T operator[](size_type pos) const noexcept { return get(pos); }
+
+  T at(size_type pos) const {
+    try {
+      if (pos >= size_)
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::packed_int_vector " << this
+                << '\n';
+      std::terminate();
+    }
+    return get(pos);
+  }
+
+  T front() const noexcept { return get(0); }
+
+  T back() const noexcept { return get(size_ - 1); }
+
+  //! Underlying words, least significant bit first, plus one zero word.
+  const word_type *data() const noexcept { return words_.data(); }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  const_iterator begin() const noexcept { return {this, 0}; }
+  const_iterator cbegin() const noexcept { return {this, 0}; }
+
+  const_iterator end() const noexcept { return {this, size_}; }
+  const_iterator cend() const noexcept { return {this, size_}; }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  //! Bits per element.
+  unsigned width() const noexcept { return width_; }
+
+  void reserve(size_type new_cap) { words_.reserve(words_needed(new_cap)); }
+
+  //! Heap bytes held, to compare with size() * sizeof(T).
+  size_type memory_bytes() const noexcept {
+    return words_.capacity() * sizeof(word_type);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void set(size_type pos, T value) {
+    fit(value, "set");
+    packing::write(words_.data(), pos * width_, width_, value);
+  }
+
+  void push_back(T value) {
+    fit(value, "push_back");
+    words_.resize(words_needed(size_ + 1), word_type{0});
+    packing::write(words_.data(), size_ * width_, width_, value);
+    ++size_;
+  }
+
+  void pop_back() noexcept {
+    if (size_ > 0)
+      packing::write(words_.data(), --size_ * width_, width_, 0);
+  }
+
+  void resize(size_type count, T value = 0) {
+    if (count < size_) {
+      while (size_ > count)
+        pop_back();
+      words_.resize(words_needed(count));
+      return;
+    }
+    fit(value, "resize");
+    words_.resize(words_needed(count), word_type{0});
+    for (; size_ < count; ++size_)
+      packing::write(words_.data(), size_ * width_, width_, value);
+  }
+
+  //! An automatic width starts over at one bit.
+  void clear() noexcept {
+    words_.assign(1, word_type{0});
+    size_ = 0;
+    if (auto_width_) {
+      width_ = 1;
+      mask_ = packing::mask(width_);
+    }
+  }
+
+  void swap(packed_int_vector &other) noexcept {
+    words_.swap(other.words_);
+    std::swap(size_, other.size_);
+    std::swap(width_, other.width_);
+    std::swap(mask_, other.mask_);
+    std::swap(auto_width_, other.auto_width_);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                             Iterator classes                          //
+  ///////////////////////////////////////////////////////////////////////////
+
+  class const_iterator {
+    const packed_int_vector *v_;
+    size_type pos_;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = T;
+
+    const_iterator() noexcept : v_{nullptr}, pos_{0} {}
+    const_iterator(const packed_int_vector *v, size_type pos) noexcept
+        : v_{v}, pos_{pos} {}
+
+    T operator*() const noexcept { return v_->get(pos_); }
+    T operator[](difference_type n) const noexcept {
+      return v_->get(pos_ + static_cast<size_type>(n));
+    }
+
+    const_iterator &operator++() noexcept {
+      ++pos_;
+      return *this;
+    }
+    const_iterator operator++(int) noexcept {
+      const_iterator t{*this};
+      ++pos_;
+      return t;
+    }
+    const_iterator &operator--() noexcept {
+      --pos_;
+      return *this;
+    }
+    const_iterator operator--(int) noexcept {
+      const_iterator t{*this};
+      --pos_;
+      return t;
+    }
+    const_iterator &operator+=(difference_type n) noexcept {
+      pos_ += static_cast<size_type>(n);
+      return *this;
+    }
+    const_iterator &operator-=(difference_type n) noexcept {
+      pos_ -= static_cast<size_type>(n);
+      return *this;
+    }
+    const_iterator operator+(difference_type n) const noexcept {
+      return const_iterator{*this} += n;
+    }
+    const_iterator operator-(difference_type n) const noexcept {
+      return const_iterator{*this} -= n;
+    }
+    difference_type operator-(const const_iterator &other) const noexcept {
+      return static_cast<difference_type>(pos_) -
+             static_cast<difference_type>(other.pos_);
+    }
+
+    bool operator==(const const_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const const_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+    bool operator<(const const_iterator &o) const noexcept {
+      return pos_ < o.pos_;
+    }
+    bool operator>(const const_iterator &o) const noexcept {
+      return pos_ > o.pos_;
+    }
+    bool operator<=(const const_iterator &o) const noexcept {
+      return pos_ <= o.pos_;
+    }
+    bool operator>=(const const_iterator &o) const noexcept {
+      return pos_ >= o.pos_;
+    }
+
+    friend const_iterator operator+(difference_type n,
+                                    const const_iterator &it) noexcept {
+      return it + n;
+    }
+  };
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                           compressed_int_vector                           //
+///////////////////////////////////////////////////////////////////////////////
+
+enum class int_coding {
+  //! Each block stores its minimum, and every value minus it: O(1) access.
+  frame_of_reference,
+  //! Each block stores its first value, and every value minus the one
+  //! before: small widths for sorted data such as posting lists, O(block)
+  //! access. Unsorted data still round-trips, the differences wrapping.
+  delta
+};
+
+//! Append-only array of unsigned integers compressed by blocks of
+//! block_size values, each block bit-packed on the width its own values
+//! need, so that a few large values only cost their block. The last values,
+//! up to a full block, wait uncompressed in a tail until their block is
+//! complete.
+//!
+//! Sequential reads should go through the iterators or for_each(), which
+//! decode a whole block at a time with a branchless loop the compiler can
+//! vectorise; get() decodes a single value.
+template <class T = std::uint32_t,
+          int_coding Coding = int_coding::frame_of_reference>
+class compressed_int_vector {
+  static_assert(std::is_integral_v<T> && std::is_unsigned_v<T> &&
+                    sizeof(T) <= sizeof(packing::word_type),
+                "compressed_int_vector stores unsigned integers");
+
+  using word_type = packing::word_type;
+
+public:
+  //! A multiple of 64, so that blocks start on a word boundary.
+  static constexpr size_type block_size = 128;
+
+  class const_iterator;
+
+  using value_type = T;
+
+private:
+  struct block {
+    size_type word; // first word in words_
+    T base;
+    unsigned char width; // 0 when all the packed values are 0
+  };
+
+  //! Pack the full tail into a new block.
+  void seal() {
+    T packed[block_size];
+    T base = tail_[0], largest = 0;
+    if constexpr (Coding == int_coding::frame_of_reference) {
+      for (size_type i = 1; i < block_size; ++i)
+        base = std::min(base, tail_[i]);
+      for (size_type i = 0; i < block_size; ++i)
+        packed[i] = static_cast<T>(tail_[i] - base);
+    } else {
+      packed[0] = 0;
+      for (size_type i = 1; i < block_size; ++i)
+        packed[i] = static_cast<T>(tail_[i] - tail_[i - 1]);
+    }
+    for (size_type i = 0; i < block_size; ++i)
+      largest = std::max(largest, packed[i]);
+    const unsigned width = largest ? packing::bits_for(largest) : 0;
+    const size_type first = words_.size() - 2; // reuse the padding words
+    words_.resize(first + block_size * width / packing::word_bits + 2,
+                  word_type{0});
+    for (size_type i = 0; i < block_size && width; ++i)
+      packing::write(words_.data() + first, i * width, width, packed[i]);
+    blocks_.push_back({first, base, static_cast<unsigned char>(width)});
+    tail_.clear();
+  }
+
+  //! Decode block b into out[0, block_size).
+  void decode(size_type b, T *out) const noexcept {
+    const block &blk = blocks_[b];
+    const word_type *w = words_.data() + blk.word;
+    const unsigned width = blk.width;
+    const word_type m = packing::mask(width);
+    const T base = blk.base;
+    if constexpr (Coding == int_coding::frame_of_reference) {
+      for (size_type i = 0; i < block_size; ++i)
+        out[i] = static_cast<T>(base + packing::read(w, i * width, m));
+    } else {
+      for (size_type i = 0; i < block_size; ++i)
+        out[i] = static_cast<T>(packing::read(w, i * width, m));
+      out[0] = base;
+      for (size_type i = 1; i < block_size; ++i)
+        out[i] = static_cast<T>(out[i] + out[i - 1]);
+    }
+  }
+
+  //! Packed blocks, then two zero words: a block of width 0 has no words,
+  //! but decoding it still reads two.
+  vector<word_type> words_;
+  vector<block> blocks_;
+  vector<T> tail_;
+  size_type size_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  compressed_int_vector()
+      : words_(2, word_type{0}), blocks_{}, tail_{}, size_{0} {}
+
+  template <class A>
+  explicit compressed_int_vector(const vector<T, A> &values)
+      : compressed_int_vector() {
+    for (size_type i = 0; i < values.size(); ++i)
+      push_back(values[i]);
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  T get(size_type pos) const noexcept {
+    const size_type b = pos / block_size;
+    if (b == blocks_.size())
+      return tail_[pos % block_size];
+    const block &blk = blocks_[b];
+    const word_type *w = words_.data() + blk.word;
+    const word_type m = packing::mask(blk.width);
+    const size_type i = pos % block_size;
+    if constexpr (Coding == int_coding::frame_of_reference) {
+      return static_cast<T>(blk.base + packing::read(w, i * blk.width, m));
+    } else {
+      word_type sum = blk.base;
+      for (size_type j = 1; j <= i; ++j)
+        sum += packing::read(w, j * blk.width, m);
+      return static_cast<T>(sum);
+    }
+  }
+
+  T operator[](size_type pos) const noexcept { return get(pos); }
+
+  T at(size_type pos) const {
+    try {
+      if (pos >= size_)
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::compressed_int_vector "
+                << this << '\n';
+      std::terminate();
+    }
+    return get(pos);
+  }
+
+  //! Call f on every value in order, decoding block by block.
+  template <class F> void for_each(F f) const {
+    T values[block_size];
+    for (size_type b = 0; b < blocks_.size(); ++b) {
+      decode(b, values);
+      for (size_type i = 0; i < block_size; ++i)
+        f(values[i]);
+    }
+    for (size_type i = 0; i < tail_.size(); ++i)
+      f(tail_[i]);
+  }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  const_iterator begin() const noexcept { return {this, 0}; }
+  const_iterator cbegin() const noexcept { return {this, 0}; }
+
+  const_iterator end() const noexcept { return {this, size_}; }
+  const_iterator cend() const noexcept { return {this, size_}; }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  //! Heap bytes held, to compare with size() * sizeof(T).
+  size_type memory_bytes() const noexcept {
+    return words_.capacity() * sizeof(word_type) +
+           blocks_.capacity() * sizeof(block) + tail_.capacity() * sizeof(T);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void push_back(T value) {
+    if (tail_.capacity() == 0)
+      tail_.reserve(block_size);
+    tail_.push_back(value);
+    ++size_;
+    if (tail_.size() == block_size)
+      seal();
+  }
+
+  void clear() noexcept {
+    words_.assign(2, word_type{0});
+    blocks_.clear();
+    tail_.clear();
+    size_ = 0;
+  }
+
+  void swap(compressed_int_vector &other) noexcept {
+    words_.swap(other.words_);
+    blocks_.swap(other.blocks_);
+    tail_.swap(other.tail_);
+    std::swap(size_, other.size_);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                             Iterator classes                          //
+  ///////////////////////////////////////////////////////////////////////////
+
+  //! Forward iterator holding the decoded block it is in.
+  class const_iterator {
+    const compressed_int_vector *v_;
+    size_type pos_;
+    mutable size_type block_; // decoded block, or npos
+    mutable T values_[block_size];
+
+    static constexpr size_type npos = static_cast<size_type>(-1);
+
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = T;
+
+    const_iterator() noexcept : v_{nullptr}, pos_{0}, block_{npos}, values_{} {}
+    const_iterator(const compressed_int_vector *v, size_type pos) noexcept
+        : v_{v}, pos_{pos}, block_{npos}, values_{} {}
+
+    T operator*() const noexcept {
+      const size_type b = pos_ / block_size;
+      if (b == v_->blocks_.size())
+        return v_->tail_[pos_ % block_size];
+      if (b != block_) {
+        v_->decode(b, values_);
+        block_ = b;
+      }
+      return values_[pos_ % block_size];
+    }
+
+    const_iterator &operator++() noexcept {
+      ++pos_;
+      return *this;
+    }
+    const_iterator operator++(int) noexcept {
+      const_iterator t{*this};
+      ++pos_;
+      return t;
+    }
+
+    bool operator==(const const_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const const_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+  };
+};
+
+} // namespace phundrak
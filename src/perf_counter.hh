@@ -0,0 +1,376 @@
+#pragma once
+
+//! Opt-in hardware counter instrumentation.
+//!
+//! Build with PHUNDRAK_PERF_COUNTERS defined to make PHUNDRAK_PERF_SCOPE(name)
+//! measure the enclosing scope with Linux's perf_event_open: cycles,
+//! instructions, L1 data cache misses, last level cache misses and data TLB
+//! misses are accumulated per name and can be dumped as JSON with
+//! phundrak::perf::report_json(). Counts are inclusive: a scope nested in
+//! another one is counted in both. When the kernel refuses to open the
+//! counters, the scopes only count calls. Without the macro, nothing below
+//! is even compiled and the scopes expand to nothing.
+//!
+//! name must be a string literal: totals are kept per thread, keyed by its
+//! address, so that closing a scope takes no lock and builds no string.
+#if !defined(PHUNDRAK_PERF_COUNTERS)
+#define PHUNDRAK_PERF_SCOPE(name)
+#else
+#define PHUNDRAK_PERF_SCOPE(name)                                              \
+  ::phundrak::perf::scoped_counter phundrak_perf_scope_ { name }
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace phundrak {
+namespace perf {
+
+enum event : unsigned {
+  cycles,
+  instructions,
+  l1d_misses,
+  llc_misses,
+  dtlb_misses,
+  num_events
+};
+
+inline const char *event_name(unsigned e) noexcept {
+  static const char *names[num_events] = {"cycles", "instructions",
+                                          "l1d_misses", "llc_misses",
+                                          "dtlb_misses"};
+  return names[e];
+}
+
+//! One reading of every counter; invalid events could not be opened.
+struct sample {
+  std::uint64_t value[num_events] = {};
+  bool valid[num_events] = {};
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               Counter group                               //
+///////////////////////////////////////////////////////////////////////////////
+
+//! The counters of the calling thread, opened once as a single perf group so
+//! that they are scheduled together and read with one read().
+class counter_group {
+#if defined(__linux__)
+  static int open_event(std::uint32_t type, std::uint64_t config,
+                        int group_fd) noexcept {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = group_fd == -1 ? 1 : 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return static_cast<int>(
+        syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0UL));
+  }
+
+  static std::uint64_t cache_miss(std::uint64_t cache) noexcept {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  }
+
+  int fds_[num_events];
+  unsigned slot_[num_events]; // position of each event in a group read
+  int leader_;
+  unsigned opened_;
+#endif
+
+public:
+  counter_group() noexcept
+#if defined(__linux__)
+      : fds_{}, slot_{}, leader_{-1}, opened_{0}
+#endif
+  {
+#if defined(__linux__)
+    const std::uint32_t types[num_events] = {
+        PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+    const std::uint64_t configs[num_events] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        cache_miss(PERF_COUNT_HW_CACHE_L1D), cache_miss(PERF_COUNT_HW_CACHE_LL),
+        cache_miss(PERF_COUNT_HW_CACHE_DTLB)};
+    for (unsigned e = 0; e < num_events; ++e) {
+      fds_[e] = open_event(types[e], configs[e], leader_);
+      if (fds_[e] < 0)
+        continue; // not permitted, or not supported by this CPU
+      if (leader_ < 0)
+        leader_ = fds_[e];
+      slot_[e] = opened_++;
+    }
+    if (leader_ >= 0) {
+      ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  counter_group(const counter_group &) = delete;
+  counter_group &operator=(const counter_group &) = delete;
+
+  ~counter_group() noexcept {
+#if defined(__linux__)
+    for (int fd : fds_)
+      if (fd >= 0)
+        close(fd);
+#endif
+  }
+
+  bool available() const noexcept {
+#if defined(__linux__)
+    return opened_ != 0;
+#else
+    return false;
+#endif
+  }
+
+  sample read() const noexcept {
+    sample s;
+#if defined(__linux__)
+    if (!opened_)
+      return s;
+    std::uint64_t buffer[1 + num_events] = {};
+    if (::read(leader_, buffer, sizeof(buffer)) < 0)
+      return s;
+    for (unsigned e = 0; e < num_events; ++e)
+      if (fds_[e] >= 0 && slot_[e] < buffer[0]) {
+        s.value[e] = buffer[1 + slot_[e]];
+        s.valid[e] = true;
+      }
+#endif
+    return s;
+  }
+
+  //! Counters of the calling thread, opened on first use.
+  static counter_group &this_thread() {
+    thread_local counter_group group;
+    return group;
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Registry                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+struct totals {
+  std::uint64_t calls;
+  sample counts;
+
+  totals() noexcept : calls{0}, counts{} {}
+};
+
+class registry;
+
+//! The totals of one thread, one slot per operation name, found by hashing
+//! the address of the name. Only the owning thread writes, so updates are
+//! plain relaxed loads and stores; the atomics only let report_json() read
+//! them from another thread.
+class thread_totals {
+  static constexpr unsigned capacity = 128; // distinct names per thread
+
+  struct slot {
+    std::atomic<const char *> name;
+    std::atomic<std::uint64_t> calls;
+    std::atomic<std::uint64_t> value[num_events];
+    std::atomic<bool> valid[num_events];
+  };
+
+  static void bump(std::atomic<std::uint64_t> &x, std::uint64_t by) noexcept {
+    x.store(x.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+  }
+
+  slot slots_[capacity];
+
+  thread_totals();
+  ~thread_totals();
+
+public:
+  thread_totals(const thread_totals &) = delete;
+  thread_totals &operator=(const thread_totals &) = delete;
+
+  //! Totals of the calling thread, registered on first use and folded into
+  //! the registry when the thread exits.
+  static thread_totals &this_thread() {
+    thread_local thread_totals t;
+    return t;
+  }
+
+  //! Names beyond capacity are not recorded.
+  void record(const char *name, const sample &start,
+              const sample &stop) noexcept {
+    unsigned i = static_cast<unsigned>(
+        (reinterpret_cast<std::uintptr_t>(name) >> 4) % capacity);
+    for (unsigned probes = 0; probes < capacity;
+         ++probes, i = (i + 1) % capacity) {
+      slot &s = slots_[i];
+      const char *owner = s.name.load(std::memory_order_relaxed);
+      if (owner == nullptr)
+        s.name.store(owner = name, std::memory_order_release);
+      if (owner != name)
+        continue;
+      bump(s.calls, 1);
+      for (unsigned e = 0; e < num_events; ++e)
+        if (start.valid[e] && stop.valid[e]) {
+          bump(s.value[e], stop.value[e] - start.value[e]);
+          s.valid[e].store(true, std::memory_order_relaxed);
+        }
+      return;
+    }
+  }
+
+  //! Add this thread's totals to ops, by name.
+  void add_to(std::map<std::string, totals> &ops) const {
+    for (const slot &s : slots_) {
+      const char *name = s.name.load(std::memory_order_acquire);
+      if (!name)
+        continue;
+      totals &t = ops[name];
+      t.calls += s.calls.load(std::memory_order_relaxed);
+      for (unsigned e = 0; e < num_events; ++e)
+        if (s.valid[e].load(std::memory_order_relaxed)) {
+          t.counts.value[e] += s.value[e].load(std::memory_order_relaxed);
+          t.counts.valid[e] = true;
+        }
+    }
+  }
+};
+
+//! Process-wide view of every thread's totals, for reporting. Recording
+//! never goes through it; only thread start, thread exit and reports take
+//! its lock.
+class registry {
+  std::mutex lock_;
+  std::set<const thread_totals *> live_;
+  std::map<std::string, totals> retired_;  // of threads that have exited
+  std::map<std::string, totals> baseline_; // subtracted, set by reset()
+  std::atomic<bool> available_;
+
+  std::map<std::string, totals> collect() {
+    std::map<std::string, totals> ops = retired_;
+    for (const thread_totals *t : live_)
+      t->add_to(ops);
+    return ops;
+  }
+
+  registry() : lock_{}, live_{}, retired_{}, baseline_{}, available_{false} {}
+
+public:
+  registry(const registry &) = delete;
+  registry &operator=(const registry &) = delete;
+
+  static registry &instance() {
+    static registry r;
+    return r;
+  }
+
+  void enter(const thread_totals *t, bool available) {
+    std::lock_guard<std::mutex> guard{lock_};
+    live_.insert(t);
+    if (available)
+      available_.store(true, std::memory_order_relaxed);
+  }
+
+  void leave(const thread_totals *t) {
+    std::lock_guard<std::mutex> guard{lock_};
+    t->add_to(retired_);
+    live_.erase(t);
+  }
+
+  //! Count from zero again, without touching the threads' totals.
+  void reset() {
+    std::lock_guard<std::mutex> guard{lock_};
+    baseline_ = collect();
+  }
+
+  std::map<std::string, totals> snapshot() {
+    std::lock_guard<std::mutex> guard{lock_};
+    std::map<std::string, totals> ops = collect();
+    for (auto &[name, t] : ops) {
+      auto base = baseline_.find(name);
+      if (base == baseline_.end())
+        continue;
+      t.calls -= base->second.calls;
+      for (unsigned e = 0; e < num_events; ++e)
+        t.counts.value[e] -= base->second.counts.value[e];
+    }
+    return ops;
+  }
+
+  bool available() const noexcept {
+    return available_.load(std::memory_order_relaxed);
+  }
+};
+
+inline thread_totals::thread_totals() : slots_{} {
+  registry::instance().enter(this, counter_group::this_thread().available());
+}
+
+inline thread_totals::~thread_totals() { registry::instance().leave(this); }
+
+//! Measures the scope it lives in and adds the deltas to the totals of the
+//! calling thread.
+class scoped_counter {
+  const char *name_;
+  sample start_;
+
+public:
+  explicit scoped_counter(const char *name)
+      : name_{name}, start_{counter_group::this_thread().read()} {}
+
+  scoped_counter(const scoped_counter &) = delete;
+  scoped_counter &operator=(const scoped_counter &) = delete;
+
+  ~scoped_counter() {
+    sample stop = counter_group::this_thread().read();
+    thread_totals::this_thread().record(name_, start_, stop);
+  }
+};
+
+inline void reset() { registry::instance().reset(); }
+
+//! Write the totals as a JSON object, with per-call averages:
+//! {"available": true, "operations": {"vector::push_back": {"calls": 3,
+//! "cycles": 120, "cycles_per_call": 40, ...}, ...}}
+//! Events the kernel refused to count are left out.
+inline void report_json(std::ostream &out) {
+  registry &r = registry::instance();
+  auto ops = r.snapshot();
+  out << "{\"available\": " << (r.available() ? "true" : "false")
+      << ", \"operations\": {";
+  bool first = true;
+  for (const auto &[name, t] : ops) {
+    if (t.calls == 0)
+      continue; // only called before reset()
+    out << (first ? "" : ", ") << '"' << name << "\": {\"calls\": " << t.calls;
+    for (unsigned e = 0; e < num_events; ++e)
+      if (t.counts.valid[e])
+        out << ", \"" << event_name(e) << "\": " << t.counts.value[e] << ", \""
+            << event_name(e) << "_per_call\": "
+            << static_cast<double>(t.counts.value[e]) /
+                   static_cast<double>(t.calls);
+    out << '}';
+    first = false;
+  }
+  out << "}}";
+}
+
+} // namespace perf
+} // namespace phundrak
+
+#endif // PHUNDRAK_PERF_COUNTERS
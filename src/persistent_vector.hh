@@ -0,0 +1,502 @@
+#pragma once
+
+#include "vector.hh"
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Immutable vector with structural sharing.
+//!
+//! Elements are stored in a 32-way trie whose leaves hold 32 elements, plus a
+//! separate tail leaf for the last elements. push_back(), set() and
+//! pop_back() leave *this untouched and return a new version that shares
+//! every node but the O(log32 n) ones on the modified path. Copying a
+//! persistent_vector is O(1) and, since nodes are never modified once
+//! shared, versions can be read from several threads at once.
+//!
+//! For bulk building, as_transient() returns a mutable view that modifies in
+//! place the nodes it created itself, and persistent() freezes it back.
+template <class T> class persistent_vector {
+public:
+  static constexpr size_type bits = 5;
+  static constexpr size_type branching = size_type{1} << bits;
+  static constexpr size_type mask = branching - 1;
+
+  class transient;
+  class const_iterator;
+
+private:
+  // data structure ///////////////////////////////////////////////////////////
+
+  //! Nodes remember the transient that created them: only that transient
+  //! may modify them in place. Persistent versions use owner 0.
+  struct node {
+    explicit node(std::uint64_t o) noexcept : owner{o} {}
+    std::uint64_t owner;
+  };
+
+  struct inner : node {
+    explicit inner(std::uint64_t o) : node{o}, child{} {}
+    std::shared_ptr<node> child[branching];
+  };
+
+  struct leaf : node {
+    explicit leaf(std::uint64_t o) : node{o}, value{} {}
+    T value[branching];
+  };
+
+  using node_ptr = std::shared_ptr<node>;
+
+  static std::uint64_t next_owner() noexcept {
+    static std::atomic<std::uint64_t> counter{0};
+    return ++counter;
+  }
+
+  static inner *as_inner(const node_ptr &n) noexcept {
+    return static_cast<inner *>(n.get());
+  }
+
+  static leaf *as_leaf(const node_ptr &n) noexcept {
+    return static_cast<leaf *>(n.get());
+  }
+
+  //! n itself if `owner` may modify it in place, a copy of it otherwise.
+  template <class Node>
+  static std::shared_ptr<Node> editable(const node_ptr &n,
+                                        std::uint64_t owner) {
+    if (!n)
+      return std::make_shared<Node>(owner);
+    if (owner && n->owner == owner)
+      return std::static_pointer_cast<Node>(n);
+    auto copy = std::make_shared<Node>(*static_cast<Node *>(n.get()));
+    copy->owner = owner;
+    return copy;
+  }
+
+  //! The trie itself; every operation modifies it in place, copying the
+  //! nodes that `owner` doesn't own.
+  struct trie {
+    size_type size = 0;
+    size_type shift = bits;
+    node_ptr root;
+    node_ptr tail;
+
+    size_type tail_offset() const noexcept {
+      return size < branching ? 0 : ((size - 1) >> bits) << bits;
+    }
+
+    const node_ptr &leaf_for(size_type i) const noexcept {
+      if (i >= tail_offset())
+        return tail;
+      const node_ptr *n = &root;
+      for (size_type level = shift; level > 0; level -= bits)
+        n = &as_inner(*n)->child[(i >> level) & mask];
+      return *n;
+    }
+
+    const T &get(size_type i) const noexcept {
+      return as_leaf(leaf_for(i))->value[i & mask];
+    }
+
+    static node_ptr new_path(size_type level, node_ptr n,
+                             std::uint64_t owner) {
+      if (level == 0)
+        return n;
+      auto ret = std::make_shared<inner>(owner);
+      ret->child[0] = new_path(level - bits, std::move(n), owner);
+      return ret;
+    }
+
+    node_ptr push_tail(size_type level, const node_ptr &parent,
+                       node_ptr tail_node, std::uint64_t owner) {
+      auto ret = editable<inner>(parent, owner);
+      size_type subidx = ((size - 1) >> level) & mask;
+      node_ptr &child = ret->child[subidx];
+      if (level == bits)
+        child = std::move(tail_node);
+      else if (child)
+        child = push_tail(level - bits, child, std::move(tail_node), owner);
+      else
+        child = new_path(level - bits, std::move(tail_node), owner);
+      return ret;
+    }
+
+    node_ptr pop_tail(size_type level, const node_ptr &n,
+                      std::uint64_t owner) {
+      size_type subidx = ((size - 2) >> level) & mask;
+      if (level > bits) {
+        node_ptr new_child =
+            pop_tail(level - bits, as_inner(n)->child[subidx], owner);
+        if (!new_child && subidx == 0)
+          return nullptr;
+        auto ret = editable<inner>(n, owner);
+        ret->child[subidx] = std::move(new_child);
+        return ret;
+      }
+      if (subidx == 0)
+        return nullptr;
+      auto ret = editable<inner>(n, owner);
+      ret->child[subidx] = nullptr;
+      return ret;
+    }
+
+    node_ptr set_in(size_type level, const node_ptr &n, size_type i,
+                    const T &value, std::uint64_t owner) {
+      if (level == 0) {
+        auto ret = editable<leaf>(n, owner);
+        ret->value[i & mask] = value;
+        return ret;
+      }
+      auto ret = editable<inner>(n, owner);
+      node_ptr &child = ret->child[(i >> level) & mask];
+      child = set_in(level - bits, child, i, value, owner);
+      return ret;
+    }
+
+    void push_back(const T &value, std::uint64_t owner) {
+      const size_type in_tail = size - tail_offset();
+      if (in_tail < branching) {
+        auto t = editable<leaf>(tail, owner);
+        t->value[in_tail] = value;
+        tail = std::move(t);
+        ++size;
+        return;
+      }
+      // the tail is full: move it into the trie
+      if ((size >> bits) > (size_type{1} << shift)) {
+        auto new_root = std::make_shared<inner>(owner);
+        new_root->child[0] = root;
+        new_root->child[1] = new_path(shift, tail, owner);
+        root = std::move(new_root);
+        shift += bits;
+      } else {
+        root = push_tail(shift, root, tail, owner);
+      }
+      auto t = std::make_shared<leaf>(owner);
+      t->value[0] = value;
+      tail = std::move(t);
+      ++size;
+    }
+
+    void set(size_type i, const T &value, std::uint64_t owner) {
+      if (i >= tail_offset()) {
+        auto t = editable<leaf>(tail, owner);
+        t->value[i & mask] = value;
+        tail = std::move(t);
+      } else {
+        root = set_in(shift, root, i, value, owner);
+      }
+    }
+
+    void pop_back(std::uint64_t owner) {
+      if (size <= 1) {
+        *this = trie{};
+        return;
+      }
+      const size_type in_tail = size - tail_offset();
+      if (in_tail > 1) {
+        auto t = editable<leaf>(tail, owner);
+        t->value[in_tail - 1] = T{};
+        tail = std::move(t);
+        --size;
+        return;
+      }
+      // the tail becomes empty: the last leaf of the trie replaces it
+      node_ptr new_tail = leaf_for(size - 2);
+      node_ptr new_root = pop_tail(shift, root, owner);
+      if (shift > bits && new_root && !as_inner(new_root)->child[1]) {
+        new_root = as_inner(new_root)->child[0];
+        shift -= bits;
+      }
+      root = std::move(new_root);
+      tail = std::move(new_tail);
+      --size;
+    }
+  };
+
+  void check_range(size_type pos) const {
+    try {
+      if (pos >= t_.size)
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::persistent_vector " << this
+                << '\n';
+      std::terminate();
+    }
+  }
+
+  explicit persistent_vector(trie t) noexcept : t_{std::move(t)} {}
+
+  trie t_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  persistent_vector() noexcept : t_{} {}
+
+  persistent_vector(std::initializer_list<T> init) : persistent_vector{} {
+    transient tr = as_transient();
+    for (const T &elem : init)
+      tr.push_back(elem);
+    *this = tr.persistent();
+  }
+
+  template <class InputIt,
+            typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                      InputIt> * = nullptr>
+  persistent_vector(InputIt first, InputIt last) : persistent_vector{} {
+    transient tr = as_transient();
+    for (; first != last; ++first)
+      tr.push_back(*first);
+    *this = tr.persistent();
+  }
+
+  explicit persistent_vector(const vector<T> &other) : persistent_vector{} {
+    transient tr = as_transient();
+    for (size_type i = 0; i < other.size(); ++i)
+      tr.push_back(other[i]);
+    *this = tr.persistent();
+  }
+
+  // Copies only share the trie, they are O(1).
+  persistent_vector(const persistent_vector &) = default;
+  persistent_vector(persistent_vector &&) noexcept = default;
+  persistent_vector &operator=(const persistent_vector &) = default;
+  persistent_vector &operator=(persistent_vector &&) noexcept = default;
+  ~persistent_vector() = default;
+
+  // Element access /////////////////////////////////////////////////////////
+
+  const T &operator[](size_type pos) const noexcept { return t_.get(pos); }
+
+  const T &at(size_type pos) const {
+    check_range(pos);
+    return t_.get(pos);
+  }
+
+  const T &front() const noexcept { return t_.get(0); }
+  const T &back() const noexcept { return t_.get(t_.size - 1); }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  const_iterator begin() const noexcept { return const_iterator{&t_, 0}; }
+  const_iterator cbegin() const noexcept { return begin(); }
+
+  const_iterator end() const noexcept { return const_iterator{&t_, t_.size}; }
+  const_iterator cend() const noexcept { return end(); }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return t_.size == 0; }
+
+  size_type size() const noexcept { return t_.size; }
+
+  // New versions ///////////////////////////////////////////////////////////
+
+  persistent_vector push_back(const T &value) const {
+    trie t{t_};
+    t.push_back(value, 0);
+    return persistent_vector{std::move(t)};
+  }
+
+  persistent_vector set(size_type pos, const T &value) const {
+    check_range(pos);
+    trie t{t_};
+    t.set(pos, value, 0);
+    return persistent_vector{std::move(t)};
+  }
+
+  persistent_vector pop_back() const {
+    trie t{t_};
+    t.pop_back(0);
+    return persistent_vector{std::move(t)};
+  }
+
+  transient as_transient() const { return transient{t_}; }
+
+  // Conversion /////////////////////////////////////////////////////////////
+
+  vector<T> to_vector() const {
+    vector<T> v;
+    v.reserve(t_.size);
+    for (const T &elem : *this)
+      v.push_back(elem);
+    return v;
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                              Transient                                //
+  ///////////////////////////////////////////////////////////////////////////
+
+  //! Mutable builder: nodes it creates are modified in place until
+  //! persistent() is called. Not thread-safe, unlike persistent versions.
+  class transient {
+    trie t_;
+    std::uint64_t owner_;
+
+    explicit transient(const trie &t) : t_{t}, owner_{next_owner()} {}
+
+  public:
+    //! A copy would share owner_ and modify the same nodes in place.
+    transient(const transient &) = delete;
+    transient &operator=(const transient &) = delete;
+
+    //! other is left empty, with an owner of its own.
+    transient(transient &&other) noexcept
+        : t_{std::exchange(other.t_, trie{})}, owner_{other.owner_} {
+      other.owner_ = next_owner();
+    }
+
+    transient &operator=(transient &&other) noexcept {
+      if (this != &other) {
+        t_ = std::exchange(other.t_, trie{});
+        owner_ = std::exchange(other.owner_, next_owner());
+      }
+      return *this;
+    }
+
+    ~transient() = default;
+
+    size_type size() const noexcept { return t_.size; }
+    bool empty() const noexcept { return t_.size == 0; }
+
+    const T &operator[](size_type pos) const noexcept { return t_.get(pos); }
+
+    transient &push_back(const T &value) {
+      t_.push_back(value, owner_);
+      return *this;
+    }
+
+    transient &set(size_type pos, const T &value) {
+      t_.set(pos, value, owner_);
+      return *this;
+    }
+
+    transient &pop_back() {
+      t_.pop_back(owner_);
+      return *this;
+    }
+
+    //! Freeze the current contents. The transient stays usable, but it will
+    //! copy nodes again from now on so that the result stays immutable.
+    persistent_vector persistent() {
+      owner_ = next_owner();
+      return persistent_vector{t_};
+    }
+
+    friend class persistent_vector;
+  };
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                              Iterator class                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  //! Random access iterator that walks the trie one leaf at a time.
+  class const_iterator {
+    const trie *t_;
+    size_type pos_;
+    const T *leaf_; // values of the leaf holding pos_ (cached)
+
+    void refresh() noexcept {
+      leaf_ = pos_ < t_->size ? as_leaf(t_->leaf_for(pos_))->value : nullptr;
+    }
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T *;
+    using reference = const T &;
+
+    const_iterator() noexcept : t_{nullptr}, pos_{0}, leaf_{nullptr} {}
+    const_iterator(const trie *t, size_type pos) noexcept
+        : t_{t}, pos_{pos}, leaf_{nullptr} {
+      refresh();
+    }
+
+    const T &operator*() const noexcept { return leaf_[pos_ & mask]; }
+    const T *operator->() const noexcept { return leaf_ + (pos_ & mask); }
+    const T &operator[](difference_type n) const noexcept {
+      return t_->get(pos_ + static_cast<size_type>(n));
+    }
+
+    const_iterator &operator++() noexcept {
+      if ((++pos_ & mask) == 0)
+        refresh();
+      return *this;
+    }
+    const_iterator operator++(int) noexcept {
+      const_iterator t{*this};
+      ++*this;
+      return t;
+    }
+    const_iterator &operator--() noexcept {
+      --pos_;
+      if (!leaf_ || (pos_ & mask) == mask)
+        refresh();
+      return *this;
+    }
+    const_iterator operator--(int) noexcept {
+      const_iterator t{*this};
+      --*this;
+      return t;
+    }
+    const_iterator &operator+=(difference_type n) noexcept {
+      pos_ += static_cast<size_type>(n);
+      refresh();
+      return *this;
+    }
+    const_iterator &operator-=(difference_type n) noexcept {
+      pos_ -= static_cast<size_type>(n);
+      refresh();
+      return *this;
+    }
+    const_iterator operator+(difference_type n) const noexcept {
+      return const_iterator{*this} += n;
+    }
+    const_iterator operator-(difference_type n) const noexcept {
+      return const_iterator{*this} -= n;
+    }
+    difference_type operator-(const const_iterator &other) const noexcept {
+      return static_cast<difference_type>(pos_) -
+             static_cast<difference_type>(other.pos_);
+    }
+
+    bool operator==(const const_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const const_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+    bool operator<(const const_iterator &o) const noexcept {
+      return pos_ < o.pos_;
+    }
+    bool operator>(const const_iterator &o) const noexcept {
+      return pos_ > o.pos_;
+    }
+    bool operator<=(const const_iterator &o) const noexcept {
+      return pos_ <= o.pos_;
+    }
+    bool operator>=(const const_iterator &o) const noexcept {
+      return pos_ >= o.pos_;
+    }
+
+    friend const_iterator operator+(difference_type n, const const_iterator &it) noexcept {
+      return it + n;
+    }
+  };
+};
+
+} // namespace phundrak
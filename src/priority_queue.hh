@@ -0,0 +1,356 @@
+#pragma once
+
+#include "vector.hh"
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! d-ary heap primitives on a random access container, Arity children per
+//! node. The element for which comp(x, y) holds for no other y is on top,
+//! as with std::push_heap: std::less gives a max-heap, std::greater a
+//! min-heap. With Arity = 4, the children of a node share one or two cache
+//! lines and the tree is half as deep as a binary heap, so pop() touches
+//! fewer lines for a few more comparisons per level.
+template <size_type Arity> struct dary_heap {
+  static_assert(Arity >= 2, "a heap needs at least two children per node");
+
+  static size_type parent(size_type i) noexcept { return (i - 1) / Arity; }
+  static size_type first_child(size_type i) noexcept { return i * Arity + 1; }
+
+  //! Move c[i] up until its parent is not below it. `moved(i)` is called for
+  //! every position whose element changed.
+  template <class C, class Compare, class Moved>
+  static size_type sift_up(C &c, size_type i, Compare &comp, Moved moved) {
+    auto value = std::move(c[i]);
+    while (i > 0) {
+      size_type p = parent(i);
+      if (!comp(c[p], value))
+        break;
+      c[i] = std::move(c[p]);
+      moved(i);
+      i = p;
+    }
+    c[i] = std::move(value);
+    moved(i);
+    return i;
+  }
+
+  //! Move c[i] down among the first n elements until no child is above it.
+  template <class C, class Compare, class Moved>
+  static size_type sift_down(C &c, size_type i, size_type n, Compare &comp,
+                             Moved moved) {
+    auto value = std::move(c[i]);
+    for (;;) {
+      size_type first = first_child(i);
+      if (first >= n)
+        break;
+      size_type last = std::min(first + Arity, n);
+      size_type best = first;
+      for (size_type k = first + 1; k < last; ++k)
+        if (comp(c[best], c[k]))
+          best = k;
+      if (!comp(value, c[best]))
+        break;
+      c[i] = std::move(c[best]);
+      moved(i);
+      i = best;
+    }
+    c[i] = std::move(value);
+    moved(i);
+    return i;
+  }
+
+  //! Floyd's bottom-up construction: O(n).
+  template <class C, class Compare, class Moved>
+  static void make_heap(C &c, size_type n, Compare &comp, Moved moved) {
+    if (n < 2)
+      return;
+    for (size_type i = parent(n - 1) + 1; i-- > 0;)
+      sift_down(c, i, n, comp, moved);
+  }
+
+  struct no_tracking {
+    void operator()(size_type) const noexcept {}
+  };
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               priority_queue                              //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Container adaptor keeping its elements in a d-ary heap. Template
+//! parameters follow std::priority_queue, plus the arity of the heap.
+template <class T, class Container = vector<T>, class Compare = std::less<T>,
+          size_type Arity = 4>
+class priority_queue {
+  using heap = dary_heap<Arity>;
+
+  Container c_;
+  Compare comp_;
+
+  void check_not_empty(const char *what) const {
+    try {
+      if (c_.empty())
+        throw std::out_of_range("Empty queue");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::priority_queue::" << what << ' '
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+public:
+  using container_type = Container;
+  using value_compare = Compare;
+  using value_type = T;
+  static constexpr size_type arity = Arity;
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  priority_queue() : c_{}, comp_{} {}
+
+  explicit priority_queue(const Compare &comp) : c_{}, comp_{comp} {}
+
+  //! Heapify cont in O(n).
+  priority_queue(const Compare &comp, Container cont)
+      : c_{std::move(cont)}, comp_{comp} {
+    heap::make_heap(c_, c_.size(), comp_, typename heap::no_tracking{});
+  }
+
+  //! Heapify [first, last) in O(n).
+  template <class InputIt>
+  priority_queue(InputIt first, InputIt last, const Compare &comp = Compare())
+      : c_{}, comp_{comp} {
+    for (; first != last; ++first)
+      c_.push_back(*first);
+    heap::make_heap(c_, c_.size(), comp_, typename heap::no_tracking{});
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  const T &top() const {
+    check_not_empty("top");
+    return c_[0];
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return c_.empty(); }
+
+  size_type size() const noexcept { return c_.size(); }
+
+  void reserve(size_type new_cap) { c_.reserve(new_cap); }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void push(const T &value) {
+    c_.push_back(value);
+    heap::sift_up(c_, c_.size() - 1, comp_, typename heap::no_tracking{});
+  }
+
+  void push(T &&value) {
+    c_.push_back(std::move(value));
+    heap::sift_up(c_, c_.size() - 1, comp_, typename heap::no_tracking{});
+  }
+
+  template <class... Args> void emplace(Args &&... args) {
+    push(T(std::forward<Args>(args)...));
+  }
+
+  void pop() {
+    check_not_empty("pop");
+    size_type n = c_.size() - 1;
+    if (n > 0) {
+      c_[0] = std::move(c_[n]);
+      c_.pop_back();
+      heap::sift_down(c_, 0, n, comp_, typename heap::no_tracking{});
+    } else {
+      c_.pop_back();
+    }
+  }
+
+  void swap(priority_queue &other) noexcept {
+    c_.swap(other.c_);
+    std::swap(comp_, other.comp_);
+  }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                           indexed_priority_queue                          //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Priority queue whose elements can be changed or erased in O(log n)
+//! through the handle push() returns, as timers are. Handles of popped or
+//! erased elements are reused by later pushes.
+//!
+//! The heap only moves handles around; every element stays in one slot of
+//! a separate vector until it is popped or erased, which destroys it right
+//! away, and a position table maps handles back to their place in the heap.
+template <class T, class Compare = std::less<T>, size_type Arity = 4>
+class indexed_priority_queue {
+public:
+  using handle = size_type;
+  static constexpr handle npos = static_cast<handle>(-1);
+
+private:
+  using heap = dary_heap<Arity>;
+
+  //! Orders handles by their values.
+  struct handle_compare {
+    const indexed_priority_queue *q;
+    bool operator()(handle a, handle b) const {
+      return q->comp_(*q->values_[a], *q->values_[b]);
+    }
+  };
+
+  //! Records the new heap position of a moved handle.
+  struct track {
+    indexed_priority_queue *q;
+    void operator()(size_type i) const noexcept { q->pos_[q->heap_[i]] = i; }
+  };
+
+  void check_handle(handle h, const char *what) const {
+    try {
+      if (!contains(h))
+        throw std::out_of_range("Invalid handle");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << ' ' << h
+                << " in phundrak::indexed_priority_queue::" << what << ' '
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+  //! Restore the heap around position i after its value changed.
+  void fix(size_type i) {
+    handle_compare comp{this};
+    if (i > 0 && comp(heap_[heap::parent(i)], heap_[i]))
+      heap::sift_up(heap_, i, comp, track{this});
+    else
+      heap::sift_down(heap_, i, heap_.size(), comp, track{this});
+  }
+
+  //! Take handle h out of the heap, destroy its value and recycle it.
+  void remove_at(size_type i) {
+    handle h = heap_[i];
+    size_type last = heap_.size() - 1;
+    if (i != last) {
+      heap_[i] = heap_[last];
+      pos_[heap_[i]] = i;
+    }
+    heap_.pop_back();
+    pos_[h] = npos;
+    values_[h].reset();
+    free_.push_back(h);
+    if (i < heap_.size())
+      fix(i);
+  }
+
+  vector<std::optional<T>> values_; // by handle, empty if free
+  vector<size_type> pos_; // heap position by handle, npos if free
+  vector<handle> heap_;
+  vector<handle> free_;
+  Compare comp_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  indexed_priority_queue() : values_{}, pos_{}, heap_{}, free_{}, comp_{} {}
+
+  explicit indexed_priority_queue(const Compare &comp)
+      : values_{}, pos_{}, heap_{}, free_{}, comp_{comp} {}
+
+  // Element access /////////////////////////////////////////////////////////
+
+  const T &top() const {
+    check_handle(top_handle(), "top");
+    return *values_[heap_[0]];
+  }
+
+  handle top_handle() const noexcept {
+    return heap_.empty() ? npos : heap_[0];
+  }
+
+  const T &operator[](handle h) const {
+    check_handle(h, "operator[]");
+    return *values_[h];
+  }
+
+  bool contains(handle h) const noexcept {
+    return h < pos_.size() && pos_[h] != npos;
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return heap_.empty(); }
+
+  size_type size() const noexcept { return heap_.size(); }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  handle push(const T &value) {
+    handle h;
+    if (free_.empty()) {
+      h = values_.size();
+      values_.emplace_back(value);
+      pos_.push_back(npos);
+    } else {
+      h = free_.back();
+      values_[h].emplace(value);
+      free_.pop_back();
+    }
+    pos_[h] = heap_.size();
+    heap_.push_back(h);
+    handle_compare comp{this};
+    heap::sift_up(heap_, heap_.size() - 1, comp, track{this});
+    return h;
+  }
+
+  void pop() {
+    check_handle(top_handle(), "pop");
+    remove_at(0);
+  }
+
+  //! Replace the value of h and move it to its new place, up or down.
+  void update(handle h, const T &value) {
+    check_handle(h, "update");
+    *values_[h] = value;
+    fix(pos_[h]);
+  }
+
+  //! Replace the value of h by one that ranks at least as high, so that it
+  //! can only move up and its children need not be looked at: with
+  //! std::greater, a min-heap, this is the classic decrease-key. The new
+  //! value must not rank lower than the old one, use update() otherwise.
+  void decrease_key(handle h, const T &value) {
+    check_handle(h, "decrease_key");
+    *values_[h] = value;
+    handle_compare comp{this};
+    heap::sift_up(heap_, pos_[h], comp, track{this});
+  }
+
+  void erase(handle h) {
+    check_handle(h, "erase");
+    remove_at(pos_[h]);
+  }
+
+  void clear() noexcept {
+    heap_.clear();
+    free_.clear();
+    pos_.clear();
+    values_.clear();
+  }
+};
+
+} // namespace phundrak
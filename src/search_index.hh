@@ -0,0 +1,191 @@
+#pragma once
+
+#include "span.hh"
+#include "vector.hh"
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Read-only index over a sorted sequence, answering lower_bound and friends
+//! with fewer cache misses than a binary search over the sequence itself.
+//!
+//! The elements are stored in Eytzinger order, the breadth-first order of
+//! the implicit binary search tree: the root is at 1 and the children of k
+//! at 2k and 2k + 1. The first levels of the tree then share a few cache
+//! lines that stay hot, and the descendants of a node a few levels down are
+//! contiguous: 16 of them four levels down for 4-byte elements, one cache
+//! line that is prefetched while the levels above are compared. The
+//! descent itself is branchless.
+//!
+//! Results are positions in the original sorted sequence, as
+//! std::lower_bound would return, so the index can sit beside the table it
+//! was built from. Elements are copied; the table need not outlive it.
+template <class T, class Compare = std::less<T>> class static_search_index {
+  //! Nodes to skip to reach the first descendant a cache line below.
+  static constexpr size_type prefetch_stride =
+      sizeof(T) <= 32 && 64 % sizeof(T) == 0 ? 64 / sizeof(T) : 0;
+
+  //! Queries in flight in the batched lower_bound.
+  static constexpr size_type batch = 16;
+
+  //! Fill the subtree rooted at k with sorted[next, ...) in order.
+  void build(const T *sorted, size_type k, size_type &next) {
+    if (k > size_)
+      return;
+    build(sorted, 2 * k, next);
+    tree_[k] = sorted[next];
+    rank_[k] = next++;
+    build(sorted, 2 * k + 1, next);
+  }
+
+  void check_sorted(const T *sorted) const {
+    try {
+      for (size_type i = 1; i < size_; ++i)
+        if (comp_(sorted[i], sorted[i - 1]))
+          throw std::invalid_argument("Unsorted input");
+    } catch (const std::invalid_argument &e) {
+      std::cout << e.what() << " in phundrak::static_search_index "
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+  void prefetch(size_type k) const noexcept {
+    if constexpr (prefetch_stride != 0)
+      __builtin_prefetch(tree_.data() + k * prefetch_stride);
+  }
+
+  //! Undo the descent: the answer is the last node where we went left,
+  //! found by dropping the trailing right turns and that left turn. 0 if
+  //! we never went left.
+  static size_type last_left_turn(size_type k) noexcept {
+    return k >> __builtin_ffsll(static_cast<long long>(~k));
+  }
+
+  //! Node of the first element not ordered before x by less(element, x),
+  //! 0 if none. less is comp_ for lower_bound, !comp_(x, element) for
+  //! upper_bound.
+  template <class Less> size_type descend(const T &x, Less less) const {
+    size_type k = 1;
+    while (k <= size_) {
+      prefetch(k);
+      k = 2 * k + static_cast<size_type>(less(tree_[k], x));
+    }
+    return last_left_turn(k);
+  }
+
+  size_type rank_of(size_type k) const noexcept {
+    return k ? rank_[k] : size_;
+  }
+
+  vector<T> tree_;         // Eytzinger order from index 1, tree_[0] unused
+  vector<size_type> rank_; // position in the sorted input, by node
+  size_type size_;
+  size_type depth_; // levels in the tree
+  Compare comp_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  static_search_index() : tree_{}, rank_{}, size_{0}, depth_{0}, comp_{} {}
+
+  //! Index sorted[0, count), which must be sorted by comp.
+  static_search_index(const T *sorted, size_type count,
+                      const Compare &comp = Compare())
+      : tree_{}, rank_{}, size_{count}, depth_{0}, comp_{comp} {
+    check_sorted(sorted);
+    if (count == 0)
+      return;
+    tree_.assign(count + 1, sorted[0]);
+    rank_.assign(count + 1, 0);
+    size_type next = 0;
+    build(sorted, 1, next);
+    for (size_type n = count; n > 0; n >>= 1)
+      ++depth_;
+  }
+
+  template <class A>
+  explicit static_search_index(const vector<T, A> &sorted,
+                               const Compare &comp = Compare())
+      : static_search_index(sorted.data(), sorted.size(), comp) {}
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  // Lookup /////////////////////////////////////////////////////////////////
+
+  //! Position of the first element not ordered before x, size() if none.
+  size_type lower_bound(const T &x) const {
+    return rank_of(descend(x, comp_));
+  }
+
+  //! Position of the first element ordered after x, size() if none.
+  size_type upper_bound(const T &x) const {
+    return rank_of(descend(x, [this](const T &element, const T &value) {
+      return !comp_(value, element);
+    }));
+  }
+
+  std::pair<size_type, size_type> equal_range(const T &x) const {
+    return {lower_bound(x), upper_bound(x)};
+  }
+
+  bool contains(const T &x) const {
+    size_type k = descend(x, comp_);
+    return k != 0 && !comp_(x, tree_[k]);
+  }
+
+  //! lower_bound of every query, results[i] for queries[i]. Queries go
+  //! down the tree in groups, one level at a time for the whole group, so
+  //! that the cache misses of a group overlap instead of following one
+  //! another.
+  void lower_bound(span<const T> queries, span<size_type> results) const {
+    try {
+      if (queries.size() != results.size())
+        throw std::length_error("Size mismatch");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << " in phundrak::static_search_index::"
+                << "lower_bound " << this << '\n';
+      std::terminate();
+    }
+    if (size_ == 0) {
+      for (size_type &r : results)
+        r = 0;
+      return;
+    }
+    size_type k[batch];
+    for (size_type first = 0; first < queries.size(); first += batch) {
+      const size_type count = std::min(batch, queries.size() - first);
+      const T *q = queries.data() + first;
+      for (size_type i = 0; i < count; ++i)
+        k[i] = 1;
+      // every level but the last is complete: no bound check
+      for (size_type level = 1; level < depth_; ++level) {
+        for (size_type i = 0; i < count; ++i)
+          prefetch(k[i]);
+        for (size_type i = 0; i < count; ++i)
+          k[i] = 2 * k[i] + static_cast<size_type>(comp_(tree_[k[i]], q[i]));
+      }
+      // past the end of the last level, turn right: last_left_turn()
+      // drops the extra right turn along with the others
+      for (size_type i = 0; i < count; ++i) {
+        size_type node = std::min(k[i], size_);
+        bool right = k[i] > size_ || comp_(tree_[node], q[i]);
+        results[first + i] = rank_of(
+            last_left_turn(2 * k[i] + static_cast<size_type>(right)));
+      }
+    }
+  }
+};
+
+} // namespace phundrak
@@ -0,0 +1,468 @@
+#pragma once
+
+#include "growth.hh"
+#include "span.hh"
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Struct-of-arrays container: every field of a row lives in its own
+//! contiguous, cache-line aligned column, so that loops touching only a few
+//! fields don't drag the others through the cache.
+//!
+//! Rows are accessed as tuples of references, columns as span<T>.
+template <class... Ts> class soa_vector {
+  static_assert(sizeof...(Ts) > 0, "soa_vector needs at least one column");
+
+public:
+  using value_type = std::tuple<Ts...>;
+  using reference = std::tuple<Ts &...>;
+  using const_reference = std::tuple<const Ts &...>;
+
+  template <size_type I>
+  using column_type = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+  static constexpr size_type column_alignment = 64;
+
+  template <bool Const> class basic_iterator;
+  using iterator = basic_iterator<false>;
+  using const_iterator = basic_iterator<true>;
+
+private:
+  using indices = std::index_sequence_for<Ts...>;
+  using columns_type = std::tuple<Ts *...>;
+
+  template <class T> static constexpr std::align_val_t alignment_of() {
+    return std::align_val_t{alignof(T) > column_alignment ? alignof(T)
+                                                          : column_alignment};
+  }
+
+  template <class T> static T *allocate(size_type n) {
+    return n ? static_cast<T *>(::operator new(n * sizeof(T), alignment_of<T>()))
+             : nullptr;
+  }
+
+  template <class T> static void deallocate(T *p) noexcept {
+    if (p)
+      ::operator delete(p, alignment_of<T>());
+  }
+
+  //! Call f(column_pointer) for every column, in order.
+  template <class F, size_type... I>
+  void each_column(F &&f, std::index_sequence<I...>) {
+    (f(std::get<I>(columns_)), ...);
+  }
+
+  template <class F> void each_column(F &&f) {
+    each_column(std::forward<F>(f), indices{});
+  }
+
+  //! Columns of n rows each; if one allocation fails, the others are freed.
+  template <size_type... I>
+  static columns_type allocate_columns(size_type n, std::index_sequence<I...>) {
+    columns_type fresh{};
+    try {
+      ((std::get<I>(fresh) = allocate<column_type<I>>(n)), ...);
+    } catch (...) {
+      (deallocate(std::get<I>(fresh)), ...);
+      throw;
+    }
+    return fresh;
+  }
+
+  template <size_type... I>
+  static void deallocate_columns(columns_type &columns,
+                                 std::index_sequence<I...>) noexcept {
+    (deallocate(std::get<I>(columns)), ...);
+  }
+
+  //! Move the rows to fresh, columns of new_cap rows, and free the old ones.
+  template <size_type... I>
+  void move_to(columns_type &fresh, size_type new_cap,
+               std::index_sequence<I...>) {
+    const size_type n = size_;
+    auto move_column = [n](auto *&column, auto *to) {
+      using T = std::remove_reference_t<decltype(*column)>;
+      for (size_type i = 0; i < n; ++i) {
+        new (to + i) T(std::move_if_noexcept(column[i]));
+        column[i].~T();
+      }
+      deallocate(column);
+      column = to;
+    };
+    (move_column(std::get<I>(columns_), std::get<I>(fresh)), ...);
+    capacity_ = new_cap;
+  }
+
+  void reallocate(size_type new_cap) {
+    columns_type fresh = allocate_columns(new_cap, indices{});
+    move_to(fresh, new_cap, indices{});
+  }
+
+  //! Construct row pos of columns, field I from args[I]. If a field throws,
+  //! the fields already constructed are destroyed.
+  template <size_type... I, class... Us>
+  static void construct_row(const columns_type &columns, size_type pos,
+                            std::index_sequence<I...>, Us &&... args) {
+    size_type built = 0;
+    try {
+      (((void)new (std::get<I>(columns) + pos)
+            column_type<I>(std::forward<Us>(args)),
+        ++built),
+       ...);
+    } catch (...) {
+      ((I < built ? std::destroy_at(std::get<I>(columns) + pos) : void()),
+       ...);
+      throw;
+    }
+  }
+
+  void destroy_range(size_type first, size_type last) noexcept {
+    each_column([first, last](auto *column) {
+      using T = std::remove_reference_t<decltype(*column)>;
+      for (size_type i = first; i < last; ++i)
+        column[i].~T();
+    });
+  }
+
+  template <size_type... I>
+  reference row(size_type pos, std::index_sequence<I...>) noexcept {
+    return reference{std::get<I>(columns_)[pos]...};
+  }
+
+  template <size_type... I>
+  const_reference row(size_type pos, std::index_sequence<I...>) const noexcept {
+    return const_reference{std::get<I>(columns_)[pos]...};
+  }
+
+  void check_range(size_type pos) const {
+    try {
+      if (pos >= size_)
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::soa_vector " << this << '\n';
+      std::terminate();
+    }
+  }
+
+  columns_type columns_;
+  size_type size_;
+  size_type capacity_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  soa_vector() noexcept : columns_{}, size_{0}, capacity_{0} {}
+
+  explicit soa_vector(size_type count) : soa_vector{} { resize(count); }
+
+  soa_vector(const soa_vector &other) : soa_vector{} {
+    reserve(other.size_);
+    for (size_type i = 0; i < other.size_; ++i)
+      std::apply([this](const Ts &... values) { emplace_back(values...); },
+                 other[i]);
+  }
+
+  soa_vector(soa_vector &&other) noexcept : soa_vector{} { swap(other); }
+
+  ~soa_vector() noexcept {
+    destroy_range(0, size_);
+    each_column([](auto *column) { deallocate(column); });
+  }
+
+  soa_vector &operator=(const soa_vector &other) {
+    soa_vector w{other};
+    swap(w);
+    return *this;
+  }
+
+  soa_vector &operator=(soa_vector &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  reference operator[](size_type pos) noexcept { return row(pos, indices{}); }
+  const_reference operator[](size_type pos) const noexcept {
+    return row(pos, indices{});
+  }
+
+  reference at(size_type pos) {
+    check_range(pos);
+    return row(pos, indices{});
+  }
+  const_reference at(size_type pos) const {
+    check_range(pos);
+    return row(pos, indices{});
+  }
+
+  reference front() noexcept { return (*this)[0]; }
+  const_reference front() const noexcept { return (*this)[0]; }
+
+  reference back() noexcept { return (*this)[size_ - 1]; }
+  const_reference back() const noexcept { return (*this)[size_ - 1]; }
+
+  //! Field I of row pos.
+  template <size_type I> column_type<I> &get(size_type pos) noexcept {
+    return std::get<I>(columns_)[pos];
+  }
+  template <size_type I> const column_type<I> &get(size_type pos) const noexcept {
+    return std::get<I>(columns_)[pos];
+  }
+
+  //! Contiguous, column_alignment-aligned storage of field I.
+  template <size_type I> span<column_type<I>> column() noexcept {
+    return span<column_type<I>>{std::get<I>(columns_), size_};
+  }
+  template <size_type I> span<const column_type<I>> column() const noexcept {
+    return span<const column_type<I>>{std::get<I>(columns_), size_};
+  }
+
+  template <size_type I> column_type<I> *data() noexcept {
+    return std::get<I>(columns_);
+  }
+  template <size_type I> const column_type<I> *data() const noexcept {
+    return std::get<I>(columns_);
+  }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  iterator begin() noexcept { return iterator{this, 0}; }
+  const_iterator begin() const noexcept { return const_iterator{this, 0}; }
+  const_iterator cbegin() const noexcept { return const_iterator{this, 0}; }
+
+  iterator end() noexcept { return iterator{this, size_}; }
+  const_iterator end() const noexcept { return const_iterator{this, size_}; }
+  const_iterator cend() const noexcept { return const_iterator{this, size_}; }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size_ == 0; }
+
+  size_type size() const noexcept { return size_; }
+
+  size_type capacity() const noexcept { return capacity_; }
+
+  void reserve(size_type new_cap) {
+    if (capacity_ < new_cap)
+      reallocate(grow_capacity(capacity_, new_cap));
+  }
+
+  void shrink_to_fit() {
+    if (capacity_ != size_)
+      reallocate(size_);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  void clear() noexcept {
+    destroy_range(0, size_);
+    size_ = 0;
+  }
+
+  void push_back(const value_type &value) {
+    std::apply([this](const Ts &... fields) { emplace_back(fields...); },
+               value);
+  }
+
+  void push_back(value_type &&value) {
+    std::apply(
+        [this](auto &&... fields) {
+          emplace_back(std::forward<decltype(fields)>(fields)...);
+        },
+        std::move(value));
+  }
+
+  //! Append a row, constructing field I from args[I]. args may refer to
+  //! fields of this vector: when it is full, the row is built in the new
+  //! columns before the old rows move out of the way.
+  template <class... Us> reference emplace_back(Us &&... args) {
+    static_assert(sizeof...(Us) == sizeof...(Ts),
+                  "emplace_back takes one argument per column");
+    if (size_ == capacity_) {
+      const size_type new_cap = grow_capacity(capacity_, size_ + 1);
+      columns_type fresh = allocate_columns(new_cap, indices{});
+      try {
+        construct_row(fresh, size_, indices{}, std::forward<Us>(args)...);
+      } catch (...) {
+        deallocate_columns(fresh, indices{});
+        throw;
+      }
+      move_to(fresh, new_cap, indices{});
+    } else {
+      construct_row(columns_, size_, indices{}, std::forward<Us>(args)...);
+    }
+    return (*this)[size_++];
+  }
+
+  void pop_back() noexcept {
+    if (size_ > 0) {
+      destroy_range(size_ - 1, size_);
+      --size_;
+    }
+  }
+
+  //! Remove rows [first, last), shifting the following rows down.
+  void erase(size_type first, size_type last) {
+    if (first >= last)
+      return;
+    const size_type n = size_;
+    each_column([first, last, n](auto *column) {
+      for (size_type i = first, j = last; j < n; ++i, ++j)
+        column[i] = std::move(column[j]);
+    });
+    destroy_range(n - (last - first), n);
+    size_ -= last - first;
+  }
+
+  void erase(size_type pos) { erase(pos, pos + 1); }
+
+  iterator erase(const_iterator pos) {
+    erase(pos.pos_);
+    return iterator{this, pos.pos_};
+  }
+
+  iterator erase(const_iterator first, const_iterator last) {
+    erase(first.pos_, last.pos_);
+    return iterator{this, first.pos_};
+  }
+
+  void resize(size_type count) {
+    if (count < size_) {
+      destroy_range(count, size_);
+      size_ = count;
+      return;
+    }
+    reserve(count);
+    while (size_ < count)
+      emplace_back(Ts{}...);
+  }
+
+  void resize(size_type count, const value_type &value) {
+    if (count < size_) {
+      destroy_range(count, size_);
+      size_ = count;
+      return;
+    }
+    reserve(count);
+    while (size_ < count)
+      push_back(value);
+  }
+
+  void swap(soa_vector &other) noexcept {
+    std::swap(columns_, other.columns_);
+    std::swap(size_, other.size_);
+    std::swap(capacity_, other.capacity_);
+  }
+
+  ///////////////////////////////////////////////////////////////////////////
+  //                              Zip iterator                             //
+  ///////////////////////////////////////////////////////////////////////////
+
+  //! Random access iterator over rows; dereferencing yields a tuple of
+  //! references into every column.
+  template <bool Const> class basic_iterator {
+    using container = std::conditional_t<Const, const soa_vector, soa_vector>;
+
+    container *v_;
+    size_type pos_;
+
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = soa_vector::value_type;
+    using difference_type = std::ptrdiff_t;
+    using reference = std::conditional_t<Const, soa_vector::const_reference,
+                                         soa_vector::reference>;
+    using pointer = void;
+
+    basic_iterator() noexcept : v_{nullptr}, pos_{0} {}
+    basic_iterator(container *v, size_type pos) noexcept : v_{v}, pos_{pos} {}
+
+    template <bool C = Const, class = std::enable_if_t<C>>
+    basic_iterator(const basic_iterator<false> &other) noexcept
+        : v_{other.v_}, pos_{other.pos_} {}
+
+    reference operator*() const noexcept { return (*v_)[pos_]; }
+    reference operator[](difference_type n) const noexcept {
+      return (*v_)[pos_ + static_cast<size_type>(n)];
+    }
+
+    basic_iterator &operator++() noexcept {
+      ++pos_;
+      return *this;
+    }
+    basic_iterator operator++(int) noexcept {
+      basic_iterator t{*this};
+      ++pos_;
+      return t;
+    }
+    basic_iterator &operator--() noexcept {
+      --pos_;
+      return *this;
+    }
+    basic_iterator operator--(int) noexcept {
+      basic_iterator t{*this};
+      --pos_;
+      return t;
+    }
+    basic_iterator &operator+=(difference_type n) noexcept {
+      pos_ += static_cast<size_type>(n);
+      return *this;
+    }
+    basic_iterator &operator-=(difference_type n) noexcept {
+      pos_ -= static_cast<size_type>(n);
+      return *this;
+    }
+    basic_iterator operator+(difference_type n) const noexcept {
+      return basic_iterator{*this} += n;
+    }
+    basic_iterator operator-(difference_type n) const noexcept {
+      return basic_iterator{*this} -= n;
+    }
+    difference_type operator-(const basic_iterator &other) const noexcept {
+      return static_cast<difference_type>(pos_) -
+             static_cast<difference_type>(other.pos_);
+    }
+
+    bool operator==(const basic_iterator &o) const noexcept {
+      return pos_ == o.pos_;
+    }
+    bool operator!=(const basic_iterator &o) const noexcept {
+      return pos_ != o.pos_;
+    }
+    bool operator<(const basic_iterator &o) const noexcept {
+      return pos_ < o.pos_;
+    }
+    bool operator>(const basic_iterator &o) const noexcept {
+      return pos_ > o.pos_;
+    }
+    bool operator<=(const basic_iterator &o) const noexcept {
+      return pos_ <= o.pos_;
+    }
+    bool operator>=(const basic_iterator &o) const noexcept {
+      return pos_ >= o.pos_;
+    }
+
+    friend basic_iterator operator+(difference_type n, const basic_iterator &it) noexcept {
+      return it + n;
+    }
+
+    friend class soa_vector;
+    friend class basic_iterator<!Const>;
+  };
+};
+
+} // namespace phundrak
@@ -0,0 +1,374 @@
+#pragma once
+
+#include "priority_queue.hh"
+#include "vector.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+namespace sort_detail {
+
+template <size_type Bytes> struct unsigned_of;
+template <> struct unsigned_of<1> { using type = std::uint8_t; };
+template <> struct unsigned_of<2> { using type = std::uint16_t; };
+template <> struct unsigned_of<4> { using type = std::uint32_t; };
+template <> struct unsigned_of<8> { using type = std::uint64_t; };
+
+//! Whether T can be sorted by its bits: integers, and IEEE floats.
+template <class T>
+constexpr bool is_radix_key =
+    (std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) <= 8) ||
+    (std::is_floating_point_v<T> && std::numeric_limits<T>::is_iec559 &&
+     (sizeof(T) == 4 || sizeof(T) == 8));
+
+//! Unsigned integer ordered as x is. Signed integers get their sign bit
+//! flipped; negative floats get all their bits flipped and the others only
+//! their sign bit, so that -0.0 comes just before +0.0 and NaNs end up at
+//! either end according to their sign.
+template <class T> auto radix_key(T x) noexcept {
+  static_assert(is_radix_key<T>, "keys must be integers or IEEE floats");
+  using U = typename unsigned_of<sizeof(T)>::type;
+  constexpr U sign = static_cast<U>(U{1} << (sizeof(T) * 8 - 1));
+  U bits;
+  std::memcpy(&bits, &x, sizeof(T));
+  if constexpr (std::is_floating_point_v<T>)
+    return static_cast<U>((bits & sign) ? ~bits : bits | sign);
+  else if constexpr (std::is_signed_v<T>)
+    return static_cast<U>(bits ^ sign);
+  else
+    return bits;
+}
+
+template <class U> unsigned digit(U key, unsigned shift) noexcept {
+  return static_cast<unsigned>((key >> shift) & 0xFF);
+}
+
+//! LSD radix sort of src[0, n) on the bytes [0, bytes) of key(x), least
+//! significant first, moving the elements back and forth between src and
+//! dst. All histograms are gathered in one pass, and a byte equal in every
+//! key costs no pass at all. Returns the buffer holding the result.
+template <class T, class Key>
+T *radix_passes(T *src, T *dst, size_type n, Key &key, unsigned bytes) {
+  size_type counts[8][256] = {};
+  for (size_type i = 0; i < n; ++i) {
+    auto k = key(src[i]);
+    for (unsigned b = 0; b < bytes; ++b)
+      ++counts[b][digit(k, 8 * b)];
+  }
+  for (unsigned b = 0; b < bytes; ++b) {
+    size_type *count = counts[b];
+    if (count[digit(key(src[0]), 8 * b)] == n)
+      continue;
+    for (size_type d = 0, offset = 0; d < 256; ++d)
+      offset += std::exchange(count[d], offset);
+    for (size_type i = 0; i < n; ++i)
+      dst[count[digit(key(src[i]), 8 * b)]++] = std::move(src[i]);
+    std::swap(src, dst);
+  }
+  return src;
+}
+
+//! Stable, for short ranges.
+template <class T, class Compare>
+void insertion_sort(T *first, T *last, Compare &comp) {
+  if (first == last)
+    return;
+  for (T *i = first + 1; i != last; ++i) {
+    T value = std::move(*i);
+    T *j = i;
+    for (; j != first && comp(value, j[-1]); --j)
+      *j = std::move(j[-1]);
+    *j = std::move(value);
+  }
+}
+
+template <class T, class Compare>
+void heap_sort(T *first, size_type n, Compare &comp) {
+  using heap = dary_heap<4>;
+  heap::make_heap(first, n, comp, heap::no_tracking{});
+  while (n > 1) {
+    --n;
+    using std::swap;
+    swap(first[0], first[n]);
+    heap::sift_down(first, 0, n, comp, heap::no_tracking{});
+  }
+}
+
+template <class T, class Compare>
+void move_median_to_first(T *result, T *a, T *b, T *c, Compare &comp) {
+  using std::swap;
+  if (comp(*a, *b)) {
+    if (comp(*b, *c))
+      swap(*result, *b);
+    else if (comp(*a, *c))
+      swap(*result, *c);
+    else
+      swap(*result, *a);
+  } else if (comp(*a, *c)) {
+    swap(*result, *a);
+  } else if (comp(*b, *c)) {
+    swap(*result, *c);
+  } else {
+    swap(*result, *b);
+  }
+}
+
+//! Hoare partition of [first, last) around pivot; the median of three
+//! guarantees an element on each side that stops the scans.
+template <class T, class Compare>
+T *unguarded_partition(T *first, T *last, const T &pivot, Compare &comp) {
+  for (;;) {
+    while (comp(*first, pivot))
+      ++first;
+    --last;
+    while (comp(pivot, *last))
+      --last;
+    if (!(first < last))
+      return first;
+    using std::swap;
+    swap(*first, *last);
+    ++first;
+  }
+}
+
+//! Quicksort with a median of three pivot, falling back to heap sort past
+//! 2 log2(n) levels and to insertion sort on short ranges. It recurses into
+//! the smaller side only, so the stack stays O(log n).
+template <class T, class Compare>
+void introsort(T *first, T *last, size_type depth, Compare &comp) {
+  constexpr std::ptrdiff_t small = 16;
+  while (last - first > small) {
+    if (depth == 0) {
+      heap_sort(first, static_cast<size_type>(last - first), comp);
+      return;
+    }
+    --depth;
+    T *mid = first + (last - first) / 2;
+    move_median_to_first(first, first + 1, mid, last - 1, comp);
+    T *cut = unguarded_partition(first + 1, last, *first, comp);
+    if (cut - first < last - cut) {
+      introsort(first, cut, depth, comp);
+      first = cut;
+    } else {
+      introsort(cut, last, depth, comp);
+      last = cut;
+    }
+  }
+  insertion_sort(first, last, comp);
+}
+
+template <class T, class Compare>
+void introsort(T *first, size_type n, Compare &comp) {
+  size_type depth = 0;
+  for (size_type m = n; m > 1; m >>= 1)
+    depth += 2;
+  introsort(first, first + n, depth, comp);
+}
+
+//! Below this many elements, a radix sort loses to insertion sort.
+constexpr size_type radix_threshold = 64;
+
+//! Below this many elements per thread, parallel_sort sorts sequentially.
+constexpr size_type parallel_threshold = size_type{1} << 16;
+
+//! Run f(0) ... f(threads - 1) on as many threads and wait for them.
+template <class F> void run_threads(unsigned threads, F f) {
+  constexpr unsigned max_threads = 64;
+  std::thread workers[max_threads];
+  for (unsigned t = 0; t < threads; ++t)
+    workers[t] = std::thread{f, t};
+  for (unsigned t = 0; t < threads; ++t)
+    workers[t].join();
+}
+
+} // namespace sort_detail
+
+///////////////////////////////////////////////////////////////////////////////
+//                                    sort                                   //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Sort v in ascending order of comp with an introsort: O(n log n), not
+//! stable.
+template <class T, class A, class Compare>
+void sort(vector<T, A> &v, Compare comp) {
+  sort_detail::introsort(v.data(), v.size(), comp);
+}
+
+//! Sort v stably in ascending order of key(x), which must return an integer
+//! or an IEEE float, with an LSD radix sort: one pass over the elements per
+//! byte of the key that is not the same in every element, plus one to
+//! count. Records move through scratch, which is grown to v.size() if it is
+//! shorter and can be kept to sort the next batch without allocating; it
+//! may come back holding v's old buffer.
+template <class T, class A, class Key>
+void sort_by_key(vector<T, A> &v, Key key, vector<T, A> &scratch) {
+  const size_type n = v.size();
+  auto bits = [&key](const T &x) { return sort_detail::radix_key(key(x)); };
+  if (n < sort_detail::radix_threshold) {
+    auto comp = [&bits](const T &a, const T &b) { return bits(a) < bits(b); };
+    sort_detail::insertion_sort(v.data(), v.data() + n, comp);
+    return;
+  }
+  if (scratch.size() < n)
+    scratch.resize(n);
+  constexpr unsigned bytes = sizeof(decltype(bits(v[0])));
+  T *sorted = sort_detail::radix_passes(v.data(), scratch.data(), n, bits,
+                                        bytes);
+  if (sorted == v.data())
+    return;
+  if (scratch.size() == n)
+    v.swap(scratch);
+  else
+    std::move(sorted, sorted + n, v.data());
+}
+
+template <class T, class A, class Key>
+void sort_by_key(vector<T, A> &v, Key key) {
+  vector<T, A> scratch{v.get_allocator()};
+  sort_by_key(v, std::move(key), scratch);
+}
+
+//! Sort integers or floats in ascending order with a radix sort, reusing
+//! scratch as sort_by_key does. Floats are ordered as by <, except that
+//! -0.0 comes before +0.0 and NaNs go to either end according to their
+//! sign.
+template <class T, class A> void sort(vector<T, A> &v, vector<T, A> &scratch) {
+  static_assert(sort_detail::is_radix_key<T>,
+                "only integers and floats can be radix sorted, pass a "
+                "comparison instead");
+  sort_by_key(v, [](const T &x) { return x; }, scratch);
+}
+
+//! Sort v in ascending order: radix sort for integers and floats, introsort
+//! on operator< for anything else.
+template <class T, class A> void sort(vector<T, A> &v) {
+  if constexpr (sort_detail::is_radix_key<T>) {
+    vector<T, A> scratch{v.get_allocator()};
+    phundrak::sort(v, scratch);
+  } else {
+    phundrak::sort(v, std::less<T>{});
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+//                               parallel_sort                               //
+///////////////////////////////////////////////////////////////////////////////
+
+//! sort_by_key on `threads` threads, hardware concurrency by default, for
+//! large inputs. One MSD pass on the 8 highest bits that differ between
+//! keys splits the elements into 256 buckets, each thread scattering its
+//! own slice; the buckets are then radix sorted on their remaining bits
+//! independently, by whichever thread is free. Stable. Keys that share
+//! their top bits are fine, but keys bunched in a few buckets leave the
+//! work to few threads.
+template <class T, class A, class Key>
+void parallel_sort_by_key(vector<T, A> &v, Key key, vector<T, A> &scratch,
+                          unsigned threads = 0) {
+  constexpr unsigned max_threads = 64;
+  if (threads == 0)
+    threads = std::thread::hardware_concurrency();
+  threads = std::clamp(threads, 1U, max_threads);
+  const size_type n = v.size();
+  if (threads == 1 || n / threads < sort_detail::parallel_threshold) {
+    sort_by_key(v, std::move(key), scratch);
+    return;
+  }
+  auto bits = [&key](const T &x) { return sort_detail::radix_key(key(x)); };
+  using U = decltype(bits(v[0]));
+  T *const data = v.data();
+  const size_type chunk = (n + threads - 1) / threads;
+  auto slice = [n, chunk](unsigned t) {
+    size_type from = std::min(n, t * chunk);
+    return std::make_pair(from, std::min(n, from + chunk));
+  };
+
+  // the highest bit any two keys differ by
+  const U first = bits(data[0]);
+  U diffs[max_threads] = {};
+  sort_detail::run_threads(threads, [&](unsigned t) {
+    auto [from, to] = slice(t);
+    U diff = 0;
+    for (size_type i = from; i < to; ++i)
+      diff |= static_cast<U>(bits(data[i]) ^ first);
+    diffs[t] = diff;
+  });
+  std::uint64_t diff = 0;
+  for (unsigned t = 0; t < threads; ++t)
+    diff |= diffs[t];
+  if (diff == 0)
+    return; // all keys are equal
+  const unsigned top = 63U - static_cast<unsigned>(__builtin_clzll(diff));
+  const unsigned shift = top >= 8 ? top - 7 : 0;
+  const unsigned low_bytes = (shift + 7) / 8;
+
+  // MSD pass: per-thread histograms, then offsets, then a parallel scatter
+  if (scratch.size() < n)
+    scratch.resize(n);
+  T *const buffer = scratch.data();
+  vector<size_type> counts(size_type{threads} * 256, 0);
+  sort_detail::run_threads(threads, [&](unsigned t) {
+    auto [from, to] = slice(t);
+    size_type *count = counts.data() + size_type{t} * 256;
+    for (size_type i = from; i < to; ++i)
+      ++count[sort_detail::digit(bits(data[i]), shift)];
+  });
+  size_type starts[257];
+  for (size_type d = 0, offset = 0; d < 256; ++d) {
+    starts[d] = offset;
+    for (size_type t = 0; t < threads; ++t)
+      offset += std::exchange(counts[t * 256 + d], offset);
+  }
+  starts[256] = n;
+  sort_detail::run_threads(threads, [&](unsigned t) {
+    auto [from, to] = slice(t);
+    size_type *offset = counts.data() + size_type{t} * 256;
+    for (size_type i = from; i < to; ++i)
+      buffer[offset[sort_detail::digit(bits(data[i]), shift)]++] =
+          std::move(data[i]);
+  });
+
+  // LSD passes within each bucket, back into v
+  std::atomic<unsigned> next_bucket{0};
+  sort_detail::run_threads(threads, [&](unsigned) {
+    for (unsigned d; (d = next_bucket.fetch_add(1)) < 256;) {
+      T *src = buffer + starts[d], *dst = data + starts[d];
+      const size_type count = starts[d + 1] - starts[d];
+      T *sorted = src;
+      if (count >= sort_detail::radix_threshold) {
+        sorted = sort_detail::radix_passes(src, dst, count, bits, low_bytes);
+      } else {
+        auto comp = [&bits](const T &a, const T &b) {
+          return bits(a) < bits(b);
+        };
+        sort_detail::insertion_sort(src, src + count, comp);
+      }
+      if (sorted != dst)
+        std::move(sorted, sorted + count, dst);
+    }
+  });
+}
+
+template <class T, class A>
+void parallel_sort(vector<T, A> &v, vector<T, A> &scratch,
+                   unsigned threads = 0) {
+  static_assert(sort_detail::is_radix_key<T>,
+                "only integers and floats can be radix sorted");
+  parallel_sort_by_key(v, [](const T &x) { return x; }, scratch, threads);
+}
+
+template <class T, class A>
+void parallel_sort(vector<T, A> &v, unsigned threads = 0) {
+  vector<T, A> scratch{v.get_allocator()};
+  parallel_sort(v, scratch, threads);
+}
+
+} // namespace phundrak
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Non-owning view over a contiguous sequence, in the spirit of C++20's
+//! std::span, for handing raw columns to vectorised loops.
+template <class T> class span {
+  T *data_;
+  size_type size_;
+
+public:
+  using element_type = T;
+  using iterator = T *;
+
+  constexpr span() noexcept : data_{nullptr}, size_{0} {}
+  constexpr span(T *data, size_type size) noexcept
+      : data_{data}, size_{size} {}
+
+  constexpr T *data() const noexcept { return data_; }
+  constexpr size_type size() const noexcept { return size_; }
+  constexpr bool empty() const noexcept { return size_ == 0; }
+
+  constexpr T &operator[](size_type pos) const noexcept { return data_[pos]; }
+  constexpr T &front() const noexcept { return data_[0]; }
+  constexpr T &back() const noexcept { return data_[size_ - 1]; }
+
+  constexpr iterator begin() const noexcept { return data_; }
+  constexpr iterator end() const noexcept { return data_ + size_; }
+
+  constexpr span subspan(size_type offset, size_type count) const noexcept {
+    return span{data_ + offset, count};
+  }
+};
+
+} // namespace phundrak
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Storage                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Whether T can live in the plain array of static_vector_storage: copying
+//! and destroying it must be trivial, and the array default constructs and
+//! assigns its elements. Default member initialisers are fine.
+template <class T>
+constexpr bool static_vector_array_storable =
+    std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T> &&
+    std::is_default_constructible_v<T> &&
+    std::is_trivially_copy_assignable_v<T>;
+
+//! Inline storage of static_vector. Trivially copyable types live in a plain
+//! array so that every operation stays usable in constant expressions and
+//! copies stay trivial; other types live in raw bytes and are constructed in
+//! place.
+template <class T, size_type N, bool = static_vector_array_storable<T>>
+class static_vector_storage;
+
+template <class T, size_type N> class static_vector_storage<T, N, true> {
+protected:
+  T data_[N]{};
+  size_type size_{0};
+
+  constexpr T *ptr() noexcept { return data_; }
+  constexpr const T *ptr() const noexcept { return data_; }
+
+  template <class... Args>
+  constexpr void construct(size_type pos, Args &&... args) {
+    data_[pos] = T(std::forward<Args>(args)...);
+  }
+
+  constexpr void destroy(size_type) noexcept {}
+};
+
+template <class T, size_type N> class static_vector_storage<T, N, false> {
+protected:
+  alignas(T) unsigned char raw_[sizeof(T) * N];
+  size_type size_;
+
+  T *ptr() noexcept { return std::launder(reinterpret_cast<T *>(raw_)); }
+  const T *ptr() const noexcept {
+    return std::launder(reinterpret_cast<const T *>(raw_));
+  }
+
+  template <class... Args> void construct(size_type pos, Args &&... args) {
+    new (raw_ + pos * sizeof(T)) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(size_type pos) noexcept { ptr()[pos].~T(); }
+
+  void destroy_all() noexcept {
+    for (size_type i = 0; i < size_; ++i)
+      destroy(i);
+    size_ = 0;
+  }
+
+public:
+  static_vector_storage() noexcept : size_{0} {}
+
+  static_vector_storage(const static_vector_storage &other) : size_{0} {
+    for (; size_ < other.size_; ++size_)
+      construct(size_, other.ptr()[size_]);
+  }
+
+  static_vector_storage(static_vector_storage &&other) noexcept(
+      std::is_nothrow_move_constructible_v<T>)
+      : size_{0} {
+    for (; size_ < other.size_; ++size_)
+      construct(size_, std::move(other.ptr()[size_]));
+  }
+
+  static_vector_storage &operator=(const static_vector_storage &other) {
+    if (this != &other) {
+      destroy_all();
+      for (; size_ < other.size_; ++size_)
+        construct(size_, other.ptr()[size_]);
+    }
+    return *this;
+  }
+
+  static_vector_storage &operator=(static_vector_storage &&other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this != &other) {
+      destroy_all();
+      for (; size_ < other.size_; ++size_)
+        construct(size_, std::move(other.ptr()[size_]));
+    }
+    return *this;
+  }
+
+  ~static_vector_storage() noexcept { destroy_all(); }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+//                               static_vector                               //
+///////////////////////////////////////////////////////////////////////////////
+
+//! Vector with a fixed capacity of N elements stored inline. It never
+//! allocates, and for trivially copyable types it stays trivially copyable
+//! and, given a constexpr default constructor, usable in constant
+//! expressions.
+template <class T, size_type N>
+class static_vector : private static_vector_storage<T, N> {
+  static_assert(N > 0, "static_vector needs a capacity of at least one");
+
+  using storage = static_vector_storage<T, N>;
+  using storage::construct;
+  using storage::destroy;
+  using storage::ptr;
+  using storage::size_;
+
+public:
+  using value_type = T;
+  using reference = T &;
+  using const_reference = const T &;
+  using iterator = T *;
+  using const_iterator = const T *;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+  using difference_type = std::ptrdiff_t;
+
+private:
+  // Not constexpr on purpose: overflowing in a constant expression is then a
+  // compile-time error.
+  static void length_error_or_die(const char *where, size_type requested) {
+    try {
+      throw std::length_error("Capacity exceeded");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << " in phundrak::static_vector::" << where
+                << ": " << requested << " elements requested, capacity is "
+                << N << '\n';
+      std::terminate();
+    }
+  }
+
+  static void out_of_range_or_die(size_type pos) {
+    try {
+      throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::static_vector: " << pos << '\n';
+      std::terminate();
+    }
+  }
+
+  //! Open a gap of `count` elements at `pos` by shifting the tail right.
+  constexpr void open_gap(size_type pos, size_type count) {
+    if (size_ + count > N)
+      length_error_or_die("insert", size_ + count);
+    T *d = ptr();
+    for (size_type i = size_; i-- > pos;) {
+      if (i + count >= size_)
+        construct(i + count, std::move(d[i]));
+      else
+        d[i + count] = std::move(d[i]);
+    }
+  }
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  constexpr static_vector() noexcept = default;
+
+  constexpr explicit static_vector(size_type count) : static_vector{} {
+    resize(count);
+  }
+
+  constexpr static_vector(size_type count, const T &value) : static_vector{} {
+    assign(count, value);
+  }
+
+  constexpr static_vector(std::initializer_list<T> init) : static_vector{} {
+    assign(init);
+  }
+
+  template <class InputIt,
+            typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                      InputIt> * = nullptr>
+  constexpr static_vector(InputIt first, InputIt last) : static_vector{} {
+    for (; first != last; ++first)
+      push_back(*first);
+  }
+
+  constexpr void assign(size_type count, const T &value) {
+    clear();
+    if (count > N)
+      length_error_or_die("assign", count);
+    for (; size_ < count; ++size_)
+      construct(size_, value);
+  }
+
+  constexpr void assign(std::initializer_list<T> ilist) {
+    clear();
+    if (ilist.size() > N)
+      length_error_or_die("assign", ilist.size());
+    for (const T &elem : ilist)
+      construct(size_++, elem);
+  }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  constexpr T &at(size_type pos) {
+    if (pos >= size_)
+      out_of_range_or_die(pos);
+    return ptr()[pos];
+  }
+
+  constexpr const T &at(size_type pos) const {
+    if (pos >= size_)
+      out_of_range_or_die(pos);
+    return ptr()[pos];
+  }
+
+  constexpr T &operator[](size_type pos) noexcept { return ptr()[pos]; }
+  constexpr const T &operator[](size_type pos) const noexcept {
+    return ptr()[pos];
+  }
+
+  constexpr T &front() noexcept { return ptr()[0]; }
+  constexpr const T &front() const noexcept { return ptr()[0]; }
+
+  constexpr T &back() noexcept { return ptr()[size_ - 1]; }
+  constexpr const T &back() const noexcept { return ptr()[size_ - 1]; }
+
+  constexpr T *data() noexcept { return ptr(); }
+  constexpr const T *data() const noexcept { return ptr(); }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  constexpr iterator begin() noexcept { return ptr(); }
+  constexpr const_iterator begin() const noexcept { return ptr(); }
+  constexpr const_iterator cbegin() const noexcept { return ptr(); }
+
+  constexpr iterator end() noexcept { return ptr() + size_; }
+  constexpr const_iterator end() const noexcept { return ptr() + size_; }
+  constexpr const_iterator cend() const noexcept { return ptr() + size_; }
+
+  constexpr reverse_iterator rbegin() noexcept { return reverse_iterator{end()}; }
+  constexpr const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator{end()};
+  }
+  constexpr reverse_iterator rend() noexcept { return reverse_iterator{begin()}; }
+  constexpr const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator{begin()};
+  }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  constexpr bool empty() const noexcept { return size_ == 0; }
+  constexpr bool full() const noexcept { return size_ == N; }
+
+  constexpr size_type size() const noexcept { return size_; }
+
+  static constexpr size_type capacity() noexcept { return N; }
+  static constexpr size_type max_size() noexcept { return N; }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  constexpr void clear() noexcept {
+    for (size_type i = 0; i < size_; ++i)
+      destroy(i);
+    size_ = 0;
+  }
+
+  constexpr iterator insert(const_iterator pos, const T &value) {
+    return emplace(pos, value);
+  }
+
+  constexpr iterator insert(const_iterator pos, T &&value) {
+    return emplace(pos, std::move(value));
+  }
+
+  constexpr iterator insert(const_iterator pos, size_type count,
+                            const T &value) {
+    size_type p = static_cast<size_type>(pos - begin());
+    T copy(value); // value may be an element that open_gap() moves
+    open_gap(p, count);
+    T *d = ptr();
+    for (size_type i = p; i < p + count; ++i) {
+      if (i >= size_)
+        construct(i, copy);
+      else
+        d[i] = copy;
+    }
+    size_ += count;
+    return begin() + p;
+  }
+
+  constexpr iterator insert(const_iterator pos, std::initializer_list<T> ilist) {
+    size_type p = static_cast<size_type>(pos - begin());
+    open_gap(p, ilist.size());
+    T *d = ptr();
+    size_type i = p;
+    for (const T &elem : ilist) {
+      if (i >= size_)
+        construct(i, elem);
+      else
+        d[i] = elem;
+      ++i;
+    }
+    size_ += ilist.size();
+    return begin() + p;
+  }
+
+  template <class... Args>
+  constexpr iterator emplace(const_iterator pos, Args &&... args) {
+    size_type p = static_cast<size_type>(pos - begin());
+    if (p == size_) {
+      emplace_back(std::forward<Args>(args)...);
+      return begin() + p;
+    }
+    T value(std::forward<Args>(args)...);
+    open_gap(p, 1);
+    ptr()[p] = std::move(value);
+    ++size_;
+    return begin() + p;
+  }
+
+  constexpr iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
+
+  constexpr iterator erase(const_iterator first, const_iterator last) {
+    size_type f = static_cast<size_type>(first - begin());
+    size_type l = static_cast<size_type>(last - begin());
+    if (f == l)
+      return begin() + f;
+    T *d = ptr();
+    for (size_type i = f, j = l; j < size_; ++i, ++j)
+      d[i] = std::move(d[j]);
+    for (size_type i = size_ - (l - f); i < size_; ++i)
+      destroy(i);
+    size_ -= l - f;
+    return begin() + f;
+  }
+
+  constexpr void push_back(const T &value) { emplace_back(value); }
+
+  constexpr void push_back(T &&value) { emplace_back(std::move(value)); }
+
+  template <class... Args> constexpr T &emplace_back(Args &&... args) {
+    if (size_ == N)
+      length_error_or_die("emplace_back", N + 1);
+    construct(size_, std::forward<Args>(args)...);
+    return ptr()[size_++];
+  }
+
+  constexpr void pop_back() noexcept {
+    if (size_ > 0)
+      destroy(--size_);
+  }
+
+  constexpr void resize(size_type count) {
+    if (count > N)
+      length_error_or_die("resize", count);
+    while (size_ > count)
+      destroy(--size_);
+    for (; size_ < count; ++size_)
+      construct(size_);
+  }
+
+  constexpr void resize(size_type count, const T &value) {
+    if (count > N)
+      length_error_or_die("resize", count);
+    while (size_ > count)
+      destroy(--size_);
+    for (; size_ < count; ++size_)
+      construct(size_, value);
+  }
+
+  constexpr void swap(static_vector &other) {
+    static_vector tmp{std::move(other)};
+    other = std::move(*this);
+    *this = std::move(tmp);
+  }
+};
+
+// Non-member functions ///////////////////////////////////////////////////////
+
+template <class T, size_type N>
+constexpr bool operator==(const static_vector<T, N> &lhs,
+                          const static_vector<T, N> &rhs) {
+  if (lhs.size() != rhs.size())
+    return false;
+  for (size_type i = 0; i < lhs.size(); ++i)
+    if (!(lhs[i] == rhs[i]))
+      return false;
+  return true;
+}
+
+template <class T, size_type N>
+constexpr bool operator!=(const static_vector<T, N> &lhs,
+                          const static_vector<T, N> &rhs) {
+  return !(lhs == rhs);
+}
+
+template <class T, size_type N>
+constexpr bool operator<(const static_vector<T, N> &lhs,
+                         const static_vector<T, N> &rhs) {
+  for (size_type i = 0; i < lhs.size() && i < rhs.size(); ++i) {
+    if (lhs[i] < rhs[i])
+      return true;
+    if (rhs[i] < lhs[i])
+      return false;
+  }
+  return lhs.size() < rhs.size();
+}
+
+} // namespace phundrak
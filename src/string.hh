@@ -0,0 +1,644 @@
+#pragma once
+
+#include "growth.hh"
+#include "perf_counter.hh"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace phundrak {
+using size_type = size_t;
+
+//! Character string with a small string optimisation: up to short_capacity
+//! characters (23 chars, 11 char16_t, 5 char32_t) live inside the object
+//! itself, which is three pointers wide like a vector, and need no
+//! allocation at all.
+//!
+//! Longer strings grow with grow_capacity() through the allocator, as
+//! vector does, and keep their buffer when cleared or assigned a shorter
+//! string, so that a string reused as a scratch buffer stops allocating
+//! once it is large enough. The contents are always null terminated.
+//!
+//! Searches go through Traits, which for char are memchr and memcmp, and
+//! find_first_of() looks characters up in a 256-bit set.
+//!
+//! In the short representation, the last character slot holds
+//! short_capacity - size(): it is the terminator when the string is full.
+//! A long string sets the highest bit of its capacity instead, which is
+//! the last byte of the object on the little-endian machines this targets.
+template <class CharT, class Traits = std::char_traits<CharT>,
+          class Allocator = std::allocator<CharT>>
+class basic_string : private Allocator { // empty allocators take no room
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+                "the short string flag assumes little endian");
+
+  using alloc_traits = std::allocator_traits<Allocator>;
+  using view_type = std::basic_string_view<CharT, Traits>;
+
+  struct long_rep {
+    CharT *data;
+    size_type size;
+    size_type cap; // with long_flag set
+  };
+
+  static constexpr size_type rep_bytes = sizeof(long_rep);
+  static constexpr size_type short_slots = rep_bytes / sizeof(CharT);
+  static constexpr size_type long_flag = size_type{1}
+                                         << (sizeof(size_type) * 8 - 1);
+
+public:
+  using traits_type = Traits;
+  using value_type = CharT;
+  using allocator_type = Allocator;
+  using iterator = CharT *;
+  using const_iterator = const CharT *;
+
+  static constexpr size_type npos = static_cast<size_type>(-1);
+  static constexpr size_type short_capacity = short_slots - 1;
+
+private:
+  union rep {
+    long_rep l;
+    CharT s[short_slots];
+  };
+  static_assert(sizeof(rep) == rep_bytes, "unexpected character size");
+
+  Allocator &alloc() noexcept { return *this; }
+  const Allocator &alloc() const noexcept { return *this; }
+
+  bool is_long() const noexcept {
+    return reinterpret_cast<const unsigned char *>(&r_)[rep_bytes - 1] & 0x80;
+  }
+
+  CharT *ptr() noexcept { return is_long() ? r_.l.data : r_.s; }
+  const CharT *ptr() const noexcept { return is_long() ? r_.l.data : r_.s; }
+
+  //! Switch to, or stay in, the short representation.
+  void set_short_size(size_type n) noexcept {
+    r_.s[short_capacity] = static_cast<CharT>(short_capacity - n);
+    Traits::assign(r_.s[n], CharT());
+  }
+
+  void set_empty() noexcept { set_short_size(0); }
+
+  //! Set the size and terminate the string.
+  void set_size(size_type n) noexcept {
+    if (is_long()) {
+      r_.l.size = n;
+      Traits::assign(r_.l.data[n], CharT());
+    } else {
+      set_short_size(n);
+    }
+  }
+
+  void set_long(CharT *data, size_type size, size_type cap) noexcept {
+    r_.l.data = data;
+    r_.l.cap = cap | long_flag;
+    r_.l.size = size;
+    Traits::assign(data[size], CharT());
+  }
+
+  void release() noexcept {
+    if (is_long())
+      alloc_traits::deallocate(alloc(), r_.l.data, capacity() + 1);
+  }
+
+  void check_length(size_type n, const char *where) const {
+    try {
+      if (n > max_size())
+        throw std::length_error("String too long");
+    } catch (const std::length_error &e) {
+      std::cout << e.what() << " in phundrak::basic_string::" << where << ' '
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+  void check_pos(size_type pos, const char *where) const {
+    try {
+      if (pos > size())
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::basic_string::" << where << ' '
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+  //! As check_pos(), for a position that must hold a character.
+  void check_index(size_type pos, const char *where) const {
+    try {
+      if (pos >= size())
+        throw std::out_of_range("Out of range");
+    } catch (const std::out_of_range &e) {
+      std::cout << e.what() << " in phundrak::basic_string::" << where << ' '
+                << this << '\n';
+      std::terminate();
+    }
+  }
+
+  //! Copy the first `keep` characters to a new buffer of new_cap, leaving
+  //! `gap` unset ones at `at`, and return it. The old buffer is left to the
+  //! caller to free.
+  CharT *regrow(size_type new_cap, size_type at, size_type gap,
+                size_type keep) {
+    PHUNDRAK_PERF_SCOPE("basic_string::grow");
+    check_length(new_cap, "reserve");
+    CharT *p = alloc_traits::allocate(alloc(), new_cap + 1);
+    const CharT *old = ptr();
+    Traits::copy(p, old, at);
+    Traits::copy(p + at + gap, old + at, keep - at);
+    return p;
+  }
+
+  //! Whether s points into the string, terminator included.
+  bool inside(const CharT *s) const noexcept {
+    const CharT *p = ptr();
+    return std::less_equal<const CharT *>{}(p, s) &&
+           std::less_equal<const CharT *>{}(s, p + size());
+  }
+
+  //! Make room for n characters at pos, shifting the rest right, and
+  //! return where they go. If src points into the string and the buffer
+  //! has to move, the n characters at src are copied into the gap before
+  //! the old buffer is freed, and src is reset to null. src must not
+  //! overlap [pos, size()).
+  CharT *open_gap(size_type pos, size_type n, const CharT *&src) {
+    const size_type sz = size(), cap = capacity();
+    if (n <= cap - sz) {
+      CharT *p = ptr();
+      Traits::move(p + pos + n, p + pos, sz - pos);
+      set_size(sz + n);
+      return p + pos;
+    }
+    const size_type new_cap = grow_capacity(cap, sz + n);
+    CharT *p = regrow(new_cap, pos, n, sz);
+    if (src && inside(src)) {
+      Traits::copy(p + pos, src, n);
+      src = nullptr;
+    }
+    release();
+    set_long(p, sz + n, new_cap);
+    return p + pos;
+  }
+
+  void init(const CharT *s, size_type n) {
+    if (n <= short_capacity) {
+      Traits::copy(r_.s, s, n);
+      set_size(n);
+    } else {
+      check_length(n, "basic_string");
+      CharT *p = alloc_traits::allocate(alloc(), n + 1);
+      Traits::copy(p, s, n);
+      set_long(p, n, n);
+    }
+  }
+
+  rep r_;
+
+public:
+  ///////////////////////////////////////////////////////////////////////////
+  //                            Member functions                           //
+  ///////////////////////////////////////////////////////////////////////////
+
+  // constructor ////////////////////////////////////////////////////////////
+
+  basic_string() noexcept(noexcept(Allocator())) : basic_string{Allocator()} {}
+
+  explicit basic_string(const Allocator &a) noexcept : Allocator{a}, r_{} {
+    set_empty();
+  }
+
+  basic_string(size_type count, CharT ch, const Allocator &a = Allocator())
+      : basic_string{a} {
+    append(count, ch);
+  }
+
+  basic_string(const CharT *s, size_type count,
+               const Allocator &a = Allocator())
+      : Allocator{a}, r_{} {
+    init(s, count);
+  }
+
+  basic_string(const CharT *s, const Allocator &a = Allocator())
+      : basic_string{s, Traits::length(s), a} {}
+
+  explicit basic_string(view_type sv, const Allocator &a = Allocator())
+      : basic_string{sv.data(), sv.size(), a} {}
+
+  basic_string(const basic_string &other)
+      : Allocator{alloc_traits::select_on_container_copy_construction(
+            other.alloc())},
+        r_{} {
+    init(other.data(), other.size());
+  }
+
+  basic_string(basic_string &&other) noexcept
+      : Allocator{std::move(other.alloc())}, r_{other.r_} {
+    other.set_empty();
+  }
+
+  ~basic_string() noexcept { release(); }
+
+  //! Reuses the buffer when other fits in it.
+  basic_string &operator=(const basic_string &other) {
+    if (this != &other)
+      assign(other.data(), other.size());
+    return *this;
+  }
+
+  basic_string &operator=(basic_string &&other) noexcept {
+    swap(other);
+    return *this;
+  }
+
+  basic_string &operator=(view_type sv) { return assign(sv.data(), sv.size()); }
+
+  basic_string &operator=(const CharT *s) {
+    return assign(s, Traits::length(s));
+  }
+
+  //! s may point into the string itself.
+  basic_string &assign(const CharT *s, size_type count) {
+    if (count <= capacity()) {
+      Traits::move(ptr(), s, count);
+      set_size(count);
+      return *this;
+    }
+    clear(); // too long to come from the string
+    return append(s, count);
+  }
+
+  basic_string &assign(view_type sv) { return assign(sv.data(), sv.size()); }
+
+  Allocator get_allocator() const { return alloc(); }
+
+  // Element access /////////////////////////////////////////////////////////
+
+  CharT &at(size_type pos) {
+    check_index(pos, "at");
+    return ptr()[pos];
+  }
+
+  const CharT &at(size_type pos) const {
+    check_index(pos, "at");
+    return ptr()[pos];
+  }
+
+  CharT &operator[](size_type pos) noexcept { return ptr()[pos]; }
+  const CharT &operator[](size_type pos) const noexcept { return ptr()[pos]; }
+
+  CharT &front() noexcept { return ptr()[0]; }
+  const CharT &front() const noexcept { return ptr()[0]; }
+
+  CharT &back() noexcept { return ptr()[size() - 1]; }
+  const CharT &back() const noexcept { return ptr()[size() - 1]; }
+
+  CharT *data() noexcept { return ptr(); }
+  const CharT *data() const noexcept { return ptr(); }
+  const CharT *c_str() const noexcept { return ptr(); }
+
+  view_type view() const noexcept { return {ptr(), size()}; }
+  operator view_type() const noexcept { return view(); }
+
+  // Iterators //////////////////////////////////////////////////////////////
+
+  iterator begin() noexcept { return ptr(); }
+  const_iterator begin() const noexcept { return ptr(); }
+  const_iterator cbegin() const noexcept { return ptr(); }
+
+  iterator end() noexcept { return ptr() + size(); }
+  const_iterator end() const noexcept { return ptr() + size(); }
+  const_iterator cend() const noexcept { return ptr() + size(); }
+
+  // Capacity ///////////////////////////////////////////////////////////////
+
+  bool empty() const noexcept { return size() == 0; }
+
+  size_type size() const noexcept {
+    return is_long() ? r_.l.size
+                     : short_capacity -
+                           static_cast<size_type>(r_.s[short_capacity]);
+  }
+
+  size_type length() const noexcept { return size(); }
+
+  size_type max_size() const noexcept {
+    return std::min<size_type>(alloc_traits::max_size(alloc()),
+                               long_flag - 1) -
+           1;
+  }
+
+  size_type capacity() const noexcept {
+    return is_long() ? r_.l.cap & ~long_flag : short_capacity;
+  }
+
+  void reserve(size_type new_cap) {
+    const size_type sz = size();
+    if (new_cap <= capacity())
+      return;
+    CharT *p = regrow(new_cap, sz, 0, sz);
+    release();
+    set_long(p, sz, new_cap);
+  }
+
+  //! Give back the unused capacity, moving back inside the object if the
+  //! string is short enough.
+  void shrink_to_fit() {
+    if (!is_long())
+      return;
+    const size_type sz = size();
+    CharT *old = r_.l.data;
+    const size_type old_cap = capacity();
+    if (sz <= short_capacity) {
+      Traits::copy(r_.s, old, sz);
+      set_short_size(sz);
+    } else if (sz < old_cap) {
+      CharT *p = regrow(sz, sz, 0, sz);
+      set_long(p, sz, sz);
+    } else {
+      return;
+    }
+    alloc_traits::deallocate(alloc(), old, old_cap + 1);
+  }
+
+  // Modifiers //////////////////////////////////////////////////////////////
+
+  //! Keeps the buffer.
+  void clear() noexcept { set_size(0); }
+
+  basic_string &append(const CharT *s, size_type count) {
+    const size_type sz = size();
+    CharT *gap = open_gap(sz, count, s);
+    if (s)
+      Traits::copy(gap, s, count);
+    return *this;
+  }
+
+  basic_string &append(view_type sv) { return append(sv.data(), sv.size()); }
+
+  basic_string &append(size_type count, CharT ch) {
+    const CharT *none = nullptr;
+    Traits::assign(open_gap(size(), count, none), count, ch);
+    return *this;
+  }
+
+  basic_string &operator+=(view_type sv) { return append(sv); }
+  basic_string &operator+=(const CharT *s) {
+    return append(s, Traits::length(s));
+  }
+  basic_string &operator+=(CharT ch) {
+    push_back(ch);
+    return *this;
+  }
+
+  void push_back(CharT ch) {
+    const size_type sz = size();
+    if (sz == capacity()) {
+      append(1, ch);
+      return;
+    }
+    Traits::assign(ptr()[sz], ch);
+    set_size(sz + 1);
+  }
+
+  void pop_back() noexcept { set_size(size() - 1); }
+
+  basic_string &insert(size_type pos, view_type sv) {
+    check_pos(pos, "insert");
+    if (!sv.empty() && inside(sv.data())) {
+      basic_string copy{sv, alloc()};
+      return insert(pos, copy.view());
+    }
+    const CharT *s = sv.data();
+    CharT *gap = open_gap(pos, sv.size(), s);
+    if (s)
+      Traits::copy(gap, s, sv.size());
+    return *this;
+  }
+
+  basic_string &erase(size_type pos = 0, size_type count = npos) {
+    check_pos(pos, "erase");
+    const size_type sz = size();
+    count = std::min(count, sz - pos);
+    CharT *p = ptr();
+    Traits::move(p + pos, p + pos + count, sz - pos - count);
+    set_size(sz - count);
+    return *this;
+  }
+
+  void resize(size_type count, CharT ch = CharT()) {
+    const size_type sz = size();
+    if (count <= sz)
+      set_size(count);
+    else
+      append(count - sz, ch);
+  }
+
+  void swap(basic_string &other) noexcept {
+    using std::swap;
+    swap(alloc(), other.alloc());
+    swap(r_, other.r_);
+  }
+
+  // Operations /////////////////////////////////////////////////////////////
+
+  basic_string substr(size_type pos = 0, size_type count = npos) const {
+    check_pos(pos, "substr");
+    return basic_string{ptr() + pos, std::min(count, size() - pos), alloc()};
+  }
+
+  int compare(view_type sv) const noexcept {
+    const size_type sz = size(), n = std::min(sz, sv.size());
+    int r = Traits::compare(ptr(), sv.data(), n);
+    if (r != 0)
+      return r;
+    return sz < sv.size() ? -1 : sz > sv.size() ? 1 : 0;
+  }
+
+  bool starts_with(view_type sv) const noexcept {
+    return size() >= sv.size() &&
+           Traits::compare(ptr(), sv.data(), sv.size()) == 0;
+  }
+
+  bool ends_with(view_type sv) const noexcept {
+    return size() >= sv.size() &&
+           Traits::compare(ptr() + size() - sv.size(), sv.data(),
+                           sv.size()) == 0;
+  }
+
+  // Search /////////////////////////////////////////////////////////////////
+
+  size_type find(CharT ch, size_type pos = 0) const noexcept {
+    const size_type sz = size();
+    if (pos >= sz)
+      return npos;
+    const CharT *p = ptr();
+    const CharT *found = Traits::find(p + pos, sz - pos, ch);
+    return found ? static_cast<size_type>(found - p) : npos;
+  }
+
+  //! Looks for the first character of sv with Traits::find, then compares
+  //! the rest.
+  size_type find(view_type sv, size_type pos = 0) const noexcept {
+    const size_type sz = size(), n = sv.size();
+    if (n == 0)
+      return pos <= sz ? pos : npos;
+    if (pos >= sz || n > sz - pos)
+      return npos;
+    const CharT *p = ptr();
+    const CharT *last = p + sz - n; // last possible start
+    for (const CharT *cur = p + pos; cur <= last; ++cur) {
+      cur = Traits::find(cur, static_cast<size_type>(last - cur) + 1, sv[0]);
+      if (!cur)
+        return npos;
+      if (Traits::compare(cur + 1, sv.data() + 1, n - 1) == 0)
+        return static_cast<size_type>(cur - p);
+    }
+    return npos;
+  }
+
+  size_type rfind(CharT ch, size_type pos = npos) const noexcept {
+    if (empty())
+      return npos;
+    const CharT *p = ptr();
+    for (size_type i = std::min(pos, size() - 1) + 1; i-- > 0;)
+      if (Traits::eq(p[i], ch))
+        return i;
+    return npos;
+  }
+
+  size_type find_first_of(view_type set, size_type pos = 0) const noexcept {
+    return find_first(set, pos, true);
+  }
+
+  size_type find_first_not_of(view_type set,
+                              size_type pos = 0) const noexcept {
+    return find_first(set, pos, false);
+  }
+
+private:
+  //! Set of byte values, one bit each.
+  struct byte_set {
+    std::uint64_t bits[4] = {};
+
+    void insert(unsigned char c) noexcept {
+      bits[c >> 6] |= std::uint64_t{1} << (c & 63);
+    }
+    bool contains(unsigned char c) const noexcept {
+      return (bits[c >> 6] >> (c & 63)) & 1;
+    }
+  };
+
+  //! First character from pos that is in set, or that is not.
+  size_type find_first(view_type set, size_type pos,
+                       bool in) const noexcept {
+    const CharT *p = ptr();
+    const size_type sz = size();
+    if constexpr (sizeof(CharT) == 1) {
+      if (in && set.size() == 1)
+        return find(set[0], pos);
+      byte_set bytes;
+      for (CharT c : set)
+        bytes.insert(static_cast<unsigned char>(c));
+      for (size_type i = pos; i < sz; ++i)
+        if (bytes.contains(static_cast<unsigned char>(p[i])) == in)
+          return i;
+    } else {
+      for (size_type i = pos; i < sz; ++i)
+        if ((Traits::find(set.data(), set.size(), p[i]) != nullptr) == in)
+          return i;
+    }
+    return npos;
+  }
+
+public:
+  // Comparison /////////////////////////////////////////////////////////////
+
+  friend bool operator==(const basic_string &a, const basic_string &b) noexcept {
+    return a.size() == b.size() && a.compare(b) == 0;
+  }
+  friend bool operator==(const basic_string &a, view_type b) noexcept {
+    return a.size() == b.size() && a.compare(b) == 0;
+  }
+  friend bool operator==(view_type a, const basic_string &b) noexcept {
+    return b == a;
+  }
+  friend bool operator==(const basic_string &a, const CharT *b) noexcept {
+    return a == view_type{b};
+  }
+  friend bool operator==(const CharT *a, const basic_string &b) noexcept {
+    return b == view_type{a};
+  }
+
+  friend bool operator!=(const basic_string &a, const basic_string &b) noexcept {
+    return !(a == b);
+  }
+  friend bool operator!=(const basic_string &a, view_type b) noexcept {
+    return !(a == b);
+  }
+  friend bool operator!=(view_type a, const basic_string &b) noexcept {
+    return !(b == a);
+  }
+  friend bool operator!=(const basic_string &a, const CharT *b) noexcept {
+    return !(a == b);
+  }
+  friend bool operator!=(const CharT *a, const basic_string &b) noexcept {
+    return !(b == a);
+  }
+
+  friend bool operator<(const basic_string &a, const basic_string &b) noexcept {
+    return a.compare(b) < 0;
+  }
+  friend bool operator<=(const basic_string &a, const basic_string &b) noexcept {
+    return a.compare(b) <= 0;
+  }
+  friend bool operator>(const basic_string &a, const basic_string &b) noexcept {
+    return a.compare(b) > 0;
+  }
+  friend bool operator>=(const basic_string &a, const basic_string &b) noexcept {
+    return a.compare(b) >= 0;
+  }
+
+  friend basic_string operator+(basic_string a, view_type b) {
+    a.append(b);
+    return a;
+  }
+  friend basic_string operator+(basic_string a, const CharT *b) {
+    a += b;
+    return a;
+  }
+  friend basic_string operator+(basic_string a, CharT b) {
+    a.push_back(b);
+    return a;
+  }
+
+  friend std::basic_ostream<CharT, Traits> &
+  operator<<(std::basic_ostream<CharT, Traits> &os, const basic_string &s) {
+    return os << s.view();
+  }
+};
+
+using string = basic_string<char>;
+using wstring = basic_string<wchar_t>;
+using u16string = basic_string<char16_t>;
+using u32string = basic_string<char32_t>;
+
+} // namespace phundrak
+
+namespace std {
+template <class CharT, class Allocator>
+struct hash<phundrak::basic_string<CharT, char_traits<CharT>, Allocator>> {
+  size_t operator()(const phundrak::basic_string<CharT, char_traits<CharT>,
+                                                 Allocator> &s) const
+      noexcept {
+    return hash<basic_string_view<CharT>>{}(s.view());
+  }
+};
+} // namespace std
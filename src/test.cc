@@ -1,11 +1,56 @@
+#include "background_reader.hh"
+#include "bit_vector.hh"
+#include "concurrent_vector.hh"
+#include "cow_vector.hh"
+#include "expression.hh"
+#include "hive.hh"
 #include "list.hh"
+#include "lru_cache.hh"
+#include "numa_allocator.hh"
+#include "packed_int_vector.hh"
+#include "persistent_vector.hh"
+#include "priority_queue.hh"
+#include "search_index.hh"
+#include "soa_vector.hh"
+#include "sort.hh"
+#include "static_vector.hh"
+#include "string.hh"
 #include "vector.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <iostream>
+#include <random>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+using phundrak::bit_vector;
+using phundrak::concurrent_vector;
+using phundrak::hive;
 using phundrak::list;
+using phundrak::numa_allocator;
+using phundrak::persistent_vector;
+using phundrak::soa_vector;
+using phundrak::static_vector;
 using phundrak::vector;
 using std::cout;
 
+struct grid_point {
+  int x = 0, y = 0; // trivially copyable but not trivial
+};
+static_assert(std::is_trivially_copyable_v<static_vector<grid_point, 4>>,
+              "trivially copyable elements keep static_vector trivially "
+              "copyable");
+
+constexpr static_vector<int, 10> make_squares() {
+  static_vector<int, 10> squares;
+  for (int i = 0; i < 10; ++i)
+    squares.push_back(i * i);
+  return squares;
+}
+
 int main(void) {
 
   cout << "\n\nTest vecteur\n";
@@ -46,5 +91,516 @@ int main(void) {
     cout << elem << " ";
   cout << "\n";
 
+  list<int> tail_run{7, 8, 8, 9, 9, 9, 9};
+  tail_run.unique();
+  list<int> same_tens{3, 12, 15, 21, 27, 29};
+  same_tens.unique([](int a, int b) { return a / 10 == b / 10; });
+  printf("unique() on a list ending in duplicates:");
+  for (const auto &elem : tail_run)
+    cout << ' ' << elem;
+  printf(", by tens:");
+  for (const auto &elem : same_tens)
+    cout << ' ' << elem;
+  list<int> sorted_odds{1, 3, 5, 7};
+  list<int> sorted_evens{0, 2, 4, 8, 10};
+  sorted_odds.merge(sorted_evens);
+  cout << "\nmerged " << sorted_odds.size() << " elements, "
+       << sorted_evens.size() << " left:";
+  for (const auto &elem : sorted_odds)
+    cout << ' ' << elem;
+  cout << "\n";
+
+  list<int> churned;
+  for (int i = 0; i < 1000; ++i)
+    churned.push_back(i);
+  for (auto it = churned.begin(); it != churned.end();) {
+    int doubled = *it * 2;
+    it = ++churned.insert(churned.erase(it), doubled);
+  }
+  churned.compact();
+  long long churned_sum = 0;
+  churned.for_each_prefetched([&churned_sum](int x) { churned_sum += x; });
+  cout << churned.size() << " elements after compaction, summing to "
+       << churned_sum << "\n";
+
+  list<int> batch(churned.begin(), churned.end());
+  batch.insert(batch.begin(), 3, -1);
+  batch.assign({4, 5, 6});
+  cout << "batch-built list of " << batch.size() << ", starting with "
+       << batch.front() << "\n";
+
+  cout << "\n\nTest bit_vector\n";
+
+  bit_vector evens(200), threes(200);
+  for (size_t i = 0; i < 200; i += 2)
+    evens[i] = true;
+  for (size_t i = 0; i < 200; i += 3)
+    threes.set(i);
+  bit_vector sixes = evens & threes;
+  cout << "multiples of 6 below 200: " << sixes.count() << "\n";
+  for (size_t i = sixes.find_first(); i != bit_vector::npos;
+       i = sixes.find_next(i))
+    if (i < 40)
+      cout << i << " ";
+  cout << "\n";
+  cout << "find_next(npos) is npos: "
+       << (sixes.find_next(bit_vector::npos) == bit_vector::npos) << "\n";
+  phundrak::rank_select rs{sixes};
+  cout << "rank1(100) = " << rs.rank1(100) << ", select1(10) = "
+       << rs.select1(10) << ", select0(10) = " << rs.select0(10) << "\n";
+
+  cout << "\n\nTest soa_vector\n";
+
+  soa_vector<int, double> points;
+  for (int i = 0; i < 10; ++i)
+    points.emplace_back(i, i * 0.5);
+  points.erase(0, 3);
+  double total = 0;
+  for (double y : points.column<1>())
+    total += y;
+  cout << points.size() << " rows, sum of column 1: " << total << "\n";
+  for (auto [x, y] : points)
+    cout << x << ":" << y << " ";
+  cout << "\n";
+
+  cout << "\n\nTest hive\n";
+
+  hive<int> entities{1, 2, 3, 4, 5, 6, 7, 8};
+  const int *four = &*std::next(entities.begin(), 3);
+  for (auto it = entities.begin(); it != entities.end();)
+    it = (*it % 2) ? entities.erase(it) : std::next(it);
+  entities.insert(9);
+  cout << "still " << *four << " at the same address, contents: ";
+  for (int e : entities)
+    cout << e << " ";
+  entities.erase(entities.begin(), entities.end());
+  cout << "\nafter erasing everything: " << entities.size() << " elements\n";
+
+  cout << "\n\nTest static_vector\n";
+
+  constexpr auto squares = make_squares();
+  static_assert(squares[9] == 81, "computed at compile time");
+  static_vector<char, 8> word{'C', 'r', 't'};
+  word.insert(word.begin() + 1, 'a');
+  word.emplace(word.begin() + 3, 'i');
+  for (auto c : word)
+    cout << c << " ";
+  cout << "| " << squares.size() << " squares, last is " << squares.back()
+       << "\n";
+
+  cout << "\n\nTest persistent_vector\n";
+
+  persistent_vector<int> v1{1, 2, 3};
+  persistent_vector<int> v2 = v1.push_back(4).set(0, 10);
+  auto builder = v2.as_transient();
+  for (int i = 5; i < 100; ++i)
+    builder.push_back(i);
+  persistent_vector<int> v3 = builder.persistent();
+  cout << "v1: " << v1.size() << " elements starting with " << v1.front()
+       << ", v2: " << v2.size() << " starting with " << v2.front()
+       << ", v3: " << v3.size() << " ending with " << v3.back() << "\n";
+
+  cout << "\n\nTest concurrent_vector\n";
+
+  concurrent_vector<int> results;
+  const int *first_result = &results.push_back(-1);
+  std::thread workers[4];
+  for (int t = 0; t < 4; ++t)
+    workers[t] = std::thread{[&results, t] {
+      for (int i = 0; i < 1000; ++i)
+        results.push_back(t * 1000 + i);
+    }};
+  for (auto &worker : workers)
+    worker.join();
+  long long result_sum = 0;
+  for (int r : results)
+    result_sum += r;
+  cout << results.size() << " results summing to " << result_sum
+       << ", first one still at the same address: " << *first_result << "\n";
+
+  cout << "\n\nTest numa_allocator\n";
+
+  vector<double, numa_allocator<double>> samples{
+      numa_allocator<double>{phundrak::numa_policy::interleave}};
+  samples.first_touch_resize(1 << 20, 0.5, 4);
+  samples.push_back(1.5);
+  double sample_sum = 0;
+  for (size_t i = 0; i < samples.size(); ++i)
+    sample_sum += samples[i];
+  cout << samples.size() << " samples summing to " << sample_sum << "\n";
+
+  cout << "\n\nTest vector expressions\n";
+
+  vector<double> xs(8), ys(8, 2.0), zs(8, 1.0);
+  for (size_t i = 0; i < xs.size(); ++i)
+    xs[i] = static_cast<double>(i);
+  vector<double> fused = xs * ys + zs;
+  fused = fused * 0.5 - xs;
+  cout << "fused[7] = " << fused[7] << ", dot = " << dot(xs, ys)
+       << ", max = " << max(sqrt(xs * xs)) << ", any > 6: " << any(xs > 6.0)
+       << ", count > 3: " << sum(xs > 3.0) << "\n";
+  vector<int> counts(4, 3);
+  cout << "sum(counts * 0.5) = " << sum(counts * 0.5) << "\n";
+
+  cout << "\n\nTest vector::append_from and background_reader\n";
+
+  std::FILE *scratch = std::tmpfile();
+  vector<int> written(100000, 3);
+  std::fwrite(written.data(), sizeof(int), written.size(), scratch);
+  std::fflush(scratch);
+  std::rewind(scratch);
+  vector<int> ingested;
+  ingested.append_from(fileno(scratch));
+  std::rewind(scratch);
+  long long streamed_sum = 0;
+  phundrak::background_reader<int> reader{fileno(scratch), 4096};
+  for (auto chunk = reader.next(); !chunk.empty(); chunk = reader.next())
+    for (int x : chunk)
+      streamed_sum += x;
+  std::fclose(scratch);
+  cout << ingested.size() << " ints ingested, " << streamed_sum
+       << " summed in the background\n";
+
+  cout << "\n\nTest priority_queue\n";
+
+  int backlog[] = {5, 1, 9, 3, 7};
+  phundrak::priority_queue<int> pq(backlog, backlog + 5);
+  pq.push(4);
+  while (!pq.empty()) {
+    cout << pq.top() << " ";
+    pq.pop();
+  }
+  phundrak::indexed_priority_queue<double, std::greater<double>> timers;
+  auto soon = timers.push(2.5);
+  auto later = timers.push(9.0);
+  timers.push(4.0);
+  timers.decrease_key(later, 1.0);
+  timers.erase(soon);
+  cout << "| next timer at " << timers.top() << ", " << timers.size()
+       << " pending\n";
+
+  cout << "\n\nTest lru_cache\n";
+
+  phundrak::lru_cache<int, int> recent{3};
+  int evictions = 0;
+  recent.on_evict([&evictions](const int &, const int &) { ++evictions; });
+  for (int i = 0; i < 5; ++i)
+    recent.put(i, i * i);
+  recent.get(2);
+  recent.put(5, 25);
+  phundrak::lfu_cache<int, int> frequent{2};
+  frequent.put(1, 1);
+  frequent.get(1);
+  frequent.put(2, 2);
+  frequent.put(3, 3);
+  phundrak::sharded_cache<phundrak::lru_cache<int, int>, 4> shared{64};
+  shared.put(7, 49);
+  cout << evictions << " evicted, 2 kept: " << recent.contains(2)
+       << ", 3 kept: " << recent.contains(3) << ", lfu kept 1: "
+       << frequent.contains(1) << ", shared[7] = " << shared.get(7).value_or(0)
+       << "\n";
+
+  cout << "\n\nTest sort\n";
+
+  std::mt19937_64 keys{42};
+  std::vector<std::uint64_t> std_keys(1 << 20);
+  vector<std::uint64_t> radix_keys, scratch_keys;
+  for (auto &k : std_keys) {
+    k = keys();
+    radix_keys.push_back(k);
+  }
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  std::sort(std_keys.begin(), std_keys.end());
+  auto std_time = clock::now() - start;
+  start = clock::now();
+  phundrak::sort(radix_keys, scratch_keys);
+  auto radix_time = clock::now() - start;
+  float raw_readings[] = {2.5f, -1.0f, 0.0f, -0.0f, 3.25f, -7.5f};
+  vector<float> readings(raw_readings, raw_readings + 6);
+  phundrak::sort(readings);
+  for (size_t i = 0; i < readings.size(); ++i)
+    cout << readings[i] << " ";
+  auto ms = [](clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  };
+  cout << "| same order as std::sort: "
+       << std::equal(std_keys.begin(), std_keys.end(), radix_keys.data())
+       << ", std::sort " << ms(std_time) << " ms, radix " << ms(radix_time)
+       << " ms\n";
+
+  cout << "\n\nTest static_search_index\n";
+
+  std::vector<std::uint64_t> probes(1 << 20);
+  for (auto &p : probes)
+    p = keys();
+  phundrak::static_search_index<std::uint64_t> index{radix_keys};
+  vector<size_t> ranks(probes.size(), 0);
+  start = clock::now();
+  size_t std_found = 0;
+  for (auto p : probes)
+    std_found += static_cast<size_t>(
+        std::lower_bound(std_keys.begin(), std_keys.end(), p) -
+        std_keys.begin());
+  std_time = clock::now() - start;
+  start = clock::now();
+  index.lower_bound({probes.data(), probes.size()},
+                    {ranks.data(), ranks.size()});
+  auto index_time = clock::now() - start;
+  size_t index_found = 0;
+  for (size_t i = 0; i < ranks.size(); ++i)
+    index_found += ranks[i];
+  cout << "same ranks as std::lower_bound: " << (std_found == index_found)
+       << ", contains(keys[7]): " << index.contains(radix_keys[7])
+       << ", std::lower_bound " << ms(std_time) << " ms, batched "
+       << ms(index_time) << " ms\n";
+
+  cout << "\n\nTest packed_int_vector and compressed_int_vector\n";
+
+  phundrak::packed_int_vector<std::uint32_t> small_ids;
+  phundrak::compressed_int_vector<std::uint32_t, phundrak::int_coding::delta>
+      postings;
+  std::uint32_t doc = 0;
+  for (int i = 0; i < (1 << 20); ++i) {
+    doc += 1 + static_cast<std::uint32_t>(keys() % 64);
+    postings.push_back(doc);
+    small_ids.push_back(doc % 1000);
+  }
+  start = clock::now();
+  std::uint64_t posting_sum = 0;
+  postings.for_each([&posting_sum](std::uint32_t d) { posting_sum += d; });
+  auto decode_time = clock::now() - start;
+  double decode_seconds = std::chrono::duration<double>(decode_time).count();
+  auto per_element = [](size_t bytes, size_t count) {
+    return static_cast<double>(bytes) / static_cast<double>(count);
+  };
+  cout << small_ids.width() << "-bit ids: "
+       << per_element(small_ids.memory_bytes(), small_ids.size())
+       << " bytes each, postings: "
+       << per_element(postings.memory_bytes(), postings.size())
+       << " bytes each, last " << postings[postings.size() - 1]
+       << ", decoded at "
+       << static_cast<double>(postings.size() * sizeof(std::uint32_t)) /
+              decode_seconds / 1e9
+       << " GB/s\n";
+  auto middle = 2 + small_ids.begin();
+  cout << "ids[2] " << *middle << ", width " << small_ids.width();
+  small_ids.clear();
+  small_ids.push_back(3);
+  cout << " then " << small_ids.width() << " after clear\n";
+
+  cout << "\n\nTest string\n";
+
+  phundrak::string name{"Cartier"};
+  phundrak::string line;
+  line.reserve(64);
+  for (int i = 0; i < 3; ++i) {
+    line.clear();
+    line += name;
+    line += ", order ";
+    line.push_back(static_cast<char>('0' + i));
+  }
+  std::string_view as_view = line;
+  cout << line << " | short: " << (name.capacity() == name.short_capacity)
+       << ", first vowel at " << name.find_first_of("aeiou") << ", \"tier\" at "
+       << name.find("tier") << ", view of " << as_view.size() << " chars\n";
+
+  cout << "\n\nTest cow_vector\n";
+
+  vector<double> table(1 << 20, 1.0);
+  phundrak::cow_vector<double> shared_table{table};
+  auto us_per_copy = [](clock::duration d, int copies) {
+    return std::chrono::duration<double, std::micro>(d).count() / copies;
+  };
+  constexpr int copies = 64;
+  double copied_sum = 0;
+  start = clock::now();
+  for (int i = 0; i < copies; ++i) {
+    vector<double> stage{table};
+    copied_sum += stage[static_cast<size_t>(i)];
+  }
+  auto deep_time = clock::now() - start;
+  start = clock::now();
+  for (int i = 0; i < copies; ++i) {
+    phundrak::cow_vector<double> stage{shared_table};
+    copied_sum += stage.get(static_cast<size_t>(i));
+  }
+  auto cow_time = clock::now() - start;
+  phundrak::cow_vector<double> edited{shared_table};
+  edited.set(0, 2.0);
+  cout << "vector copy " << us_per_copy(deep_time, copies)
+       << " us, cow_vector copy " << us_per_copy(cow_time, copies)
+       << " us, sum " << copied_sum << ", after a write: " << shared_table[0]
+       << " and " << edited[0] << "\n";
+
+  cout << "\n\nTest hive against list and vector\n";
+
+  // vector erases either by compaction or by leaving a tombstone that
+  // iteration skips and a later insertion reuses
+  struct tombstoned {
+    int value;
+    bool erased;
+  };
+  constexpr int churn = 1 << 18;
+  hive<int> churn_hive;
+  list<int> churn_list;
+  vector<int> churn_vector;
+  vector<tombstoned> churn_tombs;
+  vector<size_t> tomb_holes;
+  auto ms_f = [](clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+  };
+  auto tomb_insert = [&churn_tombs, &tomb_holes](int value) {
+    if (tomb_holes.empty()) {
+      churn_tombs.push_back(tombstoned{value, false});
+    } else {
+      churn_tombs[tomb_holes.back()] = tombstoned{value, false};
+      tomb_holes.pop_back();
+    }
+  };
+  auto tomb_erase = [&churn_tombs, &tomb_holes](size_t i) {
+    churn_tombs[i].erased = true;
+    tomb_holes.push_back(i);
+  };
+  clock::duration insert_time[4], erase_time[4], iterate_time[4],
+      mixed_time[4];
+  start = clock::now();
+  for (int i = 0; i < churn; ++i)
+    churn_hive.insert(i);
+  insert_time[0] = clock::now() - start;
+  start = clock::now();
+  for (int i = 0; i < churn; ++i)
+    churn_list.push_back(i);
+  insert_time[1] = clock::now() - start;
+  start = clock::now();
+  for (int i = 0; i < churn; ++i)
+    churn_vector.push_back(i);
+  insert_time[2] = clock::now() - start;
+  start = clock::now();
+  for (int i = 0; i < churn; ++i)
+    tomb_insert(i);
+  insert_time[3] = clock::now() - start;
+  // erase the odd elements
+  start = clock::now();
+  for (auto it = churn_hive.begin(); it != churn_hive.end();)
+    if (*it % 2)
+      it = churn_hive.erase(it);
+    else
+      ++it;
+  erase_time[0] = clock::now() - start;
+  start = clock::now();
+  for (auto it = churn_list.begin(); it != churn_list.end();)
+    if (*it % 2)
+      it = churn_list.erase(it);
+    else
+      ++it;
+  erase_time[1] = clock::now() - start;
+  start = clock::now();
+  size_t kept = 0;
+  for (size_t i = 0; i < churn_vector.size(); ++i)
+    if (churn_vector[i] % 2 == 0)
+      churn_vector[kept++] = churn_vector[i];
+  churn_vector.resize(kept);
+  erase_time[2] = clock::now() - start;
+  start = clock::now();
+  for (size_t i = 0; i < churn_tombs.size(); ++i)
+    if (churn_tombs[i].value % 2)
+      tomb_erase(i);
+  erase_time[3] = clock::now() - start;
+  long churn_sums[4] = {0, 0, 0, 0};
+  start = clock::now();
+  for (int e : churn_hive)
+    churn_sums[0] += e;
+  iterate_time[0] = clock::now() - start;
+  start = clock::now();
+  for (int e : churn_list)
+    churn_sums[1] += e;
+  iterate_time[1] = clock::now() - start;
+  start = clock::now();
+  for (size_t i = 0; i < churn_vector.size(); ++i)
+    churn_sums[2] += churn_vector[i];
+  iterate_time[2] = clock::now() - start;
+  start = clock::now();
+  for (size_t i = 0; i < churn_tombs.size(); ++i)
+    if (!churn_tombs[i].erased)
+      churn_sums[3] += churn_tombs[i].value;
+  iterate_time[3] = clock::now() - start;
+  // interleaved: every round inserts a batch, then one pass erases a third
+  // of the elements and sums the others
+  constexpr int rounds = 64;
+  constexpr int per_round = churn / rounds;
+  auto doomed = [](int value, int round) { return (value + round) % 3 == 0; };
+  long mixed_sums[4] = {0, 0, 0, 0};
+  start = clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int j = 0; j < per_round; ++j)
+      churn_hive.insert(r * per_round + j);
+    for (auto it = churn_hive.begin(); it != churn_hive.end();) {
+      if (doomed(*it, r)) {
+        it = churn_hive.erase(it);
+      } else {
+        mixed_sums[0] += *it;
+        ++it;
+      }
+    }
+  }
+  mixed_time[0] = clock::now() - start;
+  start = clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int j = 0; j < per_round; ++j)
+      churn_list.push_back(r * per_round + j);
+    for (auto it = churn_list.begin(); it != churn_list.end();) {
+      if (doomed(*it, r)) {
+        it = churn_list.erase(it);
+      } else {
+        mixed_sums[1] += *it;
+        ++it;
+      }
+    }
+  }
+  mixed_time[1] = clock::now() - start;
+  start = clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int j = 0; j < per_round; ++j)
+      churn_vector.push_back(r * per_round + j);
+    kept = 0;
+    for (size_t i = 0; i < churn_vector.size(); ++i) {
+      int value = churn_vector[i];
+      if (!doomed(value, r)) {
+        mixed_sums[2] += value;
+        churn_vector[kept++] = value;
+      }
+    }
+    churn_vector.resize(kept);
+  }
+  mixed_time[2] = clock::now() - start;
+  start = clock::now();
+  for (int r = 0; r < rounds; ++r) {
+    for (int j = 0; j < per_round; ++j)
+      tomb_insert(r * per_round + j);
+    for (size_t i = 0; i < churn_tombs.size(); ++i) {
+      if (churn_tombs[i].erased)
+        continue;
+      if (doomed(churn_tombs[i].value, r))
+        tomb_erase(i);
+      else
+        mixed_sums[3] += churn_tombs[i].value;
+    }
+  }
+  mixed_time[3] = clock::now() - start;
+  const char *churn_names[] = {"hive", "list", "vector, compacted",
+                               "vector, tombstones"};
+  for (int c = 0; c < 4; ++c)
+    cout << churn_names[c] << ": insert " << ms_f(insert_time[c])
+         << " ms, erase " << ms_f(erase_time[c]) << " ms, iterate "
+         << ms_f(iterate_time[c]) << " ms, mixed " << ms_f(mixed_time[c])
+         << " ms, sums " << churn_sums[c] << " " << mixed_sums[c] << "\n";
+
+#ifdef PHUNDRAK_PERF_COUNTERS
+  cout << "\n\nHardware counters\n";
+  phundrak::perf::report_json(cout);
+  cout << "\n";
+#endif
+
   return 0;
 }
@@ -1,28 +1,189 @@
+#pragma once
+
+#include "growth.hh"
+#include "perf_counter.hh"
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
 #include <iostream>
+#include <istream>
 #include <iterator>
 #include <memory>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 
+#if defined(__unix__)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
 namespace phundrak {
 using size_type = size_t;
 
+template <class E> struct vector_expression; // see expression.hh
+
 template <class T, class Allocator = std::allocator<T>> class vector {
 
 private:
-  void double_capacity() {
-    if (data_) {
-      T *olddata = data_;
-      capacity_ <<= 1;
-      data_ = new T[capacity_];
-      for (size_t i = 0; i < size_; ++i)
-        data_[i] = olddata[i];
-      delete[] olddata;
+  using alloc_traits = std::allocator_traits<Allocator>;
+
+  T *allocate(size_t n) {
+    return n ? alloc_traits::allocate(alloc_, n) : nullptr;
+  }
+
+  void deallocate(T *p, size_t n) noexcept {
+    if (p)
+      alloc_traits::deallocate(alloc_, p, n);
+  }
+
+  void destroy_from(size_t first) noexcept {
+    for (size_t i = first; i < size_; ++i)
+      alloc_traits::destroy(alloc_, data_ + i);
+    size_ = first;
+  }
+
+  //! reserve() without its perf scope, for members that grow the buffer as
+  //! part of an operation measured on its own.
+  void grow_to(size_t new_cap) {
+    if (capacity_ < new_cap)
+      reallocate(grow_capacity(capacity_, new_cap));
+  }
+
+  //! Move the elements to a fresh buffer of new_cap elements; only [0, size_)
+  //! is ever constructed, the rest of the buffer is raw storage.
+  void reallocate(size_t new_cap) { move_to(allocate(new_cap), new_cap); }
+
+  //! Move the elements to fresh, a buffer of new_cap elements, and free the
+  //! old one.
+  void move_to(T *fresh, size_t new_cap) {
+    for (size_t i = 0; i < size_; ++i) {
+      alloc_traits::construct(alloc_, fresh + i,
+                              std::move_if_noexcept(data_[i]));
+      alloc_traits::destroy(alloc_, data_ + i);
+    }
+    deallocate(data_, capacity_);
+    data_ = fresh;
+    capacity_ = new_cap;
+  }
+
+  //! Construct an element at the end from args, which may refer to an
+  //! element of this vector: when the buffer is full, the new element is
+  //! built in the new buffer before the old elements move out of the way.
+  template <class... Args> T &append(Args &&... args) {
+    if (size_ == capacity_) {
+      const size_t new_cap = grow_capacity(capacity_, size_ + 1);
+      T *fresh = allocate(new_cap);
+      try {
+        alloc_traits::construct(alloc_, fresh + size_,
+                                std::forward<Args>(args)...);
+      } catch (...) {
+        deallocate(fresh, new_cap);
+        throw;
+      }
+      move_to(fresh, new_cap);
     } else {
-      data_ = new T[1];
-      capacity_ = 1;
+      alloc_traits::construct(alloc_, data_ + size_,
+                              std::forward<Args>(args)...);
     }
+    return data_[size_++];
+  }
+
+  static constexpr size_t ingest_step = size_t{1} << 16; // bytes
+
+  //! Fill the unused capacity with read(buffer, n), which returns how many
+  //! bytes it stored and 0 at the end of the input. When `known`, the input
+  //! holds at least max_bytes bytes and room for them is made up front.
+  template <class Read> size_t ingest(size_t max_bytes, bool known, Read read) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "append_from() needs trivially copyable elements");
+    const size_t first = size_;
+    size_t budget = max_bytes / sizeof(T) * sizeof(T);
+    size_t pending = 0; // bytes of the incomplete element at size_
+    if (known && capacity_ < size_ + budget / sizeof(T))
+      reallocate(size_ + budget / sizeof(T));
+    while (budget) {
+      if (size_ == capacity_)
+        grow_to(size_ + std::max<size_t>(ingest_step / sizeof(T), 1));
+      size_t room = (capacity_ - size_) * sizeof(T) - pending;
+      char *tail = reinterpret_cast<char *>(data_ + size_) + pending;
+      size_t got = read(tail, std::min(room, budget));
+      if (got == 0)
+        break;
+      budget -= got;
+      pending += got;
+      size_ += pending / sizeof(T);
+      pending %= sizeof(T);
+    }
+    return size_ - first;
+  }
+
+  //! Up to n of the CPUs the calling thread may run on, in cpus; returns
+  //! how many, 0 where affinity is not supported.
+  static unsigned allowed_cpus(size_t *cpus, unsigned n) noexcept {
+    unsigned found = 0;
+#if defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+      return 0;
+    for (size_t cpu = 0; cpu < CPU_SETSIZE && found < n; ++cpu)
+      if (CPU_ISSET(cpu, &allowed))
+        cpus[found++] = cpu;
+#endif
+    (void)cpus;
+    (void)n;
+    return found;
+  }
+
+  //! Keep the calling thread on cpu, if the system lets us.
+  static void pin_to_cpu(size_t cpu) noexcept {
+#if defined(__linux__)
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+#endif
+    (void)cpu;
+  }
+
+  //! Construct [size_, count) with `threads` threads, each one touching a
+  //! contiguous slice first so that its pages are placed near that thread.
+  //! Slice i is built by a thread pinned to the i-th CPU the caller may run
+  //! on, wrapping around, so that the placement does not depend on where
+  //! the scheduler happens to put the workers.
+  void parallel_construct(size_t count, const T &value, unsigned threads) {
+    constexpr unsigned max_threads = 64;
+    if (threads == 0)
+      threads = std::thread::hardware_concurrency();
+    threads = std::clamp(threads, 1U, max_threads);
+    if (capacity_ < count)
+      reallocate(count); // exact: no slack pages touched by nobody
+    const size_t first = size_;
+    const size_t chunk = (count - first + threads - 1) / threads;
+    size_t cpus[max_threads];
+    const unsigned num_cpus = allowed_cpus(cpus, threads);
+    auto fill = [this, &value, num_cpus](size_t from, size_t to, size_t cpu) {
+      if (num_cpus)
+        pin_to_cpu(cpu);
+      for (size_t i = from; i < to; ++i)
+        alloc_traits::construct(alloc_, data_ + i, value);
+    };
+    std::thread workers[max_threads];
+    unsigned started = 0;
+    for (size_t from = first; from < count; ++started) {
+      size_t to = count - from < chunk ? count : from + chunk;
+      size_t cpu = num_cpus ? cpus[started % num_cpus] : 0;
+      workers[started] = std::thread{fill, from, to, cpu};
+      from = to;
+    }
+    for (unsigned i = 0; i < started; ++i)
+      workers[i].join();
+    size_ = count;
   }
 
   T *data_;
@@ -44,99 +205,122 @@ public:
       : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {}
 
   vector(size_type count, const T &value, const Allocator &alloc = Allocator())
-      : vector{alloc}, data_{nullptr}, size_{0}, capacity_{0} {
+      : vector{alloc} {
     for (size_t i = 0; i < count; ++i)
-      push_back(value);
+      emplace_back(value);
   }
 
   explicit vector(size_type count, const Allocator &alloc = Allocator())
       : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {
-    for (size_type i = 0; i < count; ++i)
-      push_back(T{});
+    grow_to(count);
+    for (; size_ < count; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_);
   }
 
-  template <class InputIt>
+  template <typename InputIt,
+            typename std::enable_if_t<!std::is_integral<InputIt>::value,
+                                      InputIt> * = nullptr>
   vector(InputIt first, InputIt last, const Allocator &alloc = Allocator())
       : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {
     for (; first != last; ++first)
-      push_back(*first);
+      emplace_back(*first);
+  }
+
+  //! Evaluate an expression from expression.hh in a single pass.
+  template <class E>
+  vector(const vector_expression<E> &expr, const Allocator &alloc = Allocator())
+      : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {
+    const E &e = expr.self();
+    reallocate(e.size());
+    for (; size_ < capacity_; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_, e[size_]);
   }
 
   // Copy constructor ///////////////////////////////////////////////////////
 
-  vector(const vector<T> &other)
-      : data_{new T[other.size_]}, size_{other.size_},
-        capacity_{other.capacity_}, alloc_{other.alloc_} {
-    if (!alloc_) {
-      alloc_ = std::allocator_traits<Allocator>::
-          select_on_container_copy_construction(other.get_allocator());
-    }
-    for (size_type i = 0; i < size_; ++i)
-      data_[i] = other.data_[i];
-  }
+  vector(const vector &other)
+      : vector{other, alloc_traits::select_on_container_copy_construction(
+                          other.alloc_)} {}
 
   vector(const vector &other, const Allocator &alloc)
-      : data_{new T[other.size_]}, size_{other.size},
-        capacity_{other.capacity_}, alloc_{alloc} {
-    try {
-      if (alloc_ != other.alloc_)
-        throw 20;
-    } catch (int error) {
-      std::cout << "Error in phundrak::vector(const vector &other, const "
-                   "Allocator &alloc) :\nThe allocator "
-                << alloc
-                << " passed as argument is different from other’s allocator "
-                << other.alloc_ << "\nAborting...\n";
-      std::terminate();
-    }
-
-    for (size_type i = 0; i < size_; ++i)
-      data_[i] = other.data_[i];
+      : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {
+    data_ = allocate(other.size_);
+    capacity_ = other.size_;
+    for (; size_ < other.size_; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_, other.data_[size_]);
   }
 
   // Move constructor ///////////////////////////////////////////////////////
 
-  vector(vector<T> &&other) noexcept {
+  vector(vector &&other) noexcept
+      : data_{nullptr}, size_{0}, capacity_{0}, alloc_{other.alloc_} {
     std::swap(data_, other.data_);
     std::swap(size_, other.size_);
     std::swap(capacity_, other.capacity_);
-    std::swap(alloc_, other.alloc_);
   }
 
-  vector(vector &&other, const Allocator &alloc) {
-    if (alloc != other.alloc_) {
-      capacity_ = other.capacity_;
-      size_ = other.size_;
-      data_ = new T[capacity_];
-      alloc_ = alloc;
-      for (size_type i = 0; i < size_; ++i) {
-        data_[i] = std::move(other.data_[i]);
-      }
+  vector(vector &&other, const Allocator &alloc)
+      : data_{nullptr}, size_{0}, capacity_{0}, alloc_{alloc} {
+    if (alloc_ != other.alloc_) {
+      grow_to(other.size_);
+      for (; size_ < other.size_; ++size_)
+        alloc_traits::construct(alloc_, data_ + size_,
+                                std::move(other.data_[size_]));
     } else {
-      std::swap(capacity_, other.capacity);
-      std::swap(size_, other.size);
+      std::swap(capacity_, other.capacity_);
+      std::swap(size_, other.size_);
       std::swap(data_, other.data_);
-      std::swap(alloc_, other.alloc_);
     }
   }
 
   //! Destructor
-  virtual ~vector() noexcept { delete[] data_; }
+  virtual ~vector() noexcept {
+    destroy_from(0);
+    deallocate(data_, capacity_);
+  }
 
   //! Copy assignment operator
-  vector &operator=(const vector<T> &other) {
-    vector<T> w{other};
-    std::swap(data_, w.data_);
-    std::swap(size_, w.size_);
-    std::swap(capacity_, w.capacity_);
+  vector &operator=(const vector &other) {
+    vector w{other};
+    swap(w);
     return *this;
   }
 
   //! Move assignment operator
   vector &operator=(vector &&other) noexcept {
-    std::swap(data_, other.data_);
-    std::swap(size_, other.size_);
-    std::swap(capacity_, other.capacity_);
+    swap(other);
+    return *this;
+  }
+
+  //! Evaluate an expression from expression.hh in a single pass, reusing
+  //! the buffer when it is large enough. An expression that reads this
+  //! vector is still evaluated in place, since element i only depends on
+  //! the elements at index i of its operands; it goes through a temporary
+  //! only if the buffer has to be reallocated first.
+  template <class E> vector &operator=(const vector_expression<E> &expr) {
+    PHUNDRAK_PERF_SCOPE("vector::evaluate");
+    const E &e = expr.self();
+    const size_t n = e.size();
+    if (capacity_ < n) {
+      if (e.references(data_)) {
+        vector w{expr, alloc_};
+        swap(w);
+        return *this;
+      }
+      destroy_from(0);
+      reallocate(n);
+    }
+    if (n < size_)
+      destroy_from(n);
+    T *out = data_;
+    const size_t kept = size_;
+#if defined(__GNUC__)
+#pragma GCC ivdep
+#endif
+    for (size_t i = 0; i < kept; ++i)
+      out[i] = e[i];
+    for (; size_ < n; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_, e[size_]);
     return *this;
   }
 
@@ -144,22 +328,84 @@ public:
   const T &operator=(size_t pos) const { return data_[pos]; }
 
   void assign(size_t count, const T &value) {
-    clear();
-    reserve(count);
-    for (size_t i = 0; i < count; ++i)
-      push_back(value);
+    PHUNDRAK_PERF_SCOPE("vector::assign");
+    destroy_from(0);
+    grow_to(count);
+    for (; size_ < count; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_, value);
   }
 
   template <typename InputIt,
             typename std::enable_if_t<!std::is_integral<InputIt>::value,
                                       InputIt> * = nullptr>
   void assign(InputIt first, InputIt last) {
-    clear();
-    capacity_ = std::distance(first, last);
-    size_ = capacity_;
-    data_ = new T[capacity_];
-    for (int i = 0; first != last, i < size_; ++first, ++i)
-      data_[i] = *first;
+    PHUNDRAK_PERF_SCOPE("vector::assign");
+    destroy_from(0);
+    if constexpr (std::is_base_of_v<
+                      std::forward_iterator_tag,
+                      typename std::iterator_traits<InputIt>::iterator_category>)
+      grow_to(static_cast<size_t>(std::distance(first, last)));
+    for (; first != last; ++first)
+      emplace_back(*first);
+  }
+
+  //! assign(count, value), but the elements are constructed by `threads`
+  //! threads, each one writing a contiguous slice of the buffer first. On
+  //! NUMA machines with a first-touch policy, or with numa_allocator's
+  //! local policy, every slice then lives on the node of the thread that
+  //! built it: process the vector with the same partitioning afterwards.
+  //! With threads = 0, uses one thread per hardware thread (at most 64).
+  //!
+  //! T's copy constructor must not throw: an exception escaping a worker
+  //! thread calls std::terminate().
+  void first_touch_assign(size_t count, const T &value, unsigned threads = 0) {
+    PHUNDRAK_PERF_SCOPE("vector::first_touch_assign");
+    destroy_from(0);
+    parallel_construct(count, value, threads);
+  }
+
+#if defined(__unix__)
+  //! Append the elements stored in the next bytes read from fd, at most
+  //! max_bytes of them. Bytes are read straight into the unused capacity,
+  //! without an intermediate buffer or a per-element capacity check, and
+  //! only whole elements are committed. Capacity grows by at least
+  //! ingest_step bytes at a time. Stops at end of file, after max_bytes or
+  //! on a read error, which is left in errno; the bytes of a trailing
+  //! incomplete element are consumed but dropped. A regular file is read up
+  //! to the last whole element it holds when called, with a single exact
+  //! reallocation. Returns the number of elements appended.
+  size_t append_from(int fd, size_t max_bytes = static_cast<size_t>(-1)) {
+    PHUNDRAK_PERF_SCOPE("vector::append_from");
+    bool known = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      off_t offset = lseek(fd, 0, SEEK_CUR);
+      if (offset >= 0) {
+        known = true;
+        off_t left = std::max<off_t>(st.st_size - offset, 0);
+        max_bytes = std::min(max_bytes, static_cast<size_t>(left));
+      }
+    }
+    return ingest(max_bytes, known, [fd](char *buffer, size_t n) {
+      for (;;) {
+        ssize_t got = ::read(fd, buffer, n);
+        if (got >= 0)
+          return static_cast<size_t>(got);
+        if (errno != EINTR)
+          return size_t{0};
+      }
+    });
+  }
+#endif
+
+  //! append_from(fd, max_bytes) for a binary std::istream.
+  size_t append_from(std::istream &in,
+                     size_t max_bytes = static_cast<size_t>(-1)) {
+    PHUNDRAK_PERF_SCOPE("vector::append_from");
+    return ingest(max_bytes, false, [&in](char *buffer, size_t n) {
+      in.read(buffer, static_cast<std::streamsize>(n));
+      return static_cast<size_t>(in.gcount());
+    });
   }
 
   // Element access /////////////////////////////////////////////////////////
@@ -205,72 +451,85 @@ public:
 
   // Capacity ///////////////////////////////////////////////////////////////
 
-  bool empty() const noexcept { return (data_ == nullptr) ? true : false; }
+  bool empty() const noexcept { return size_ == 0; }
 
   size_t size() const noexcept { return size_; }
 
   void reserve(size_t new_cap) {
-    while (capacity_ < new_cap)
-      double_capacity();
+    PHUNDRAK_PERF_SCOPE("vector::reserve");
+    grow_to(new_cap);
   }
 
   size_t capacity() const noexcept { return capacity_; }
 
   void shrink_to_fit() {
-    T *olddata = data_;
-    capacity_ = size_;
-    data_ = new T[capacity_];
-    for (size_t i = 0; i < size_; ++i)
-      data_[i] = olddata[i];
-    delete[] olddata;
+    PHUNDRAK_PERF_SCOPE("vector::shrink_to_fit");
+    if (capacity_ != size_)
+      reallocate(size_);
   }
 
   // Modifiers //////////////////////////////////////////////////////////////
 
   void clear() noexcept {
-    delete[] data_;
-    data_ = new T[capacity_];
-    size_ = 0;
+    PHUNDRAK_PERF_SCOPE("vector::clear");
+    destroy_from(0);
   }
 
   // insert: can't do iterators :(
   // emplace: can't do iterators :(
   // erase: can't do iterators :(
 
+  //! value may be an element of the vector, even when it has to grow; so
+  //! may the arguments of emplace_back().
   void push_back(const T &value) {
-    ++size_;
-    reserve(size_);
-    data_[size_ - 1] = value;
+    PHUNDRAK_PERF_SCOPE("vector::push_back");
+    append(value);
   }
 
   void push_back(T &&value) {
-    ++size_;
-    reserve(size_);
-    data_[size_ - 1] = std::move(value);
+    PHUNDRAK_PERF_SCOPE("vector::push_back");
+    append(std::move(value));
   }
 
-  // emplace_back: don't know how to use std::allocator_traits
+  template <class... Args> T &emplace_back(Args &&... args) {
+    return append(std::forward<Args>(args)...);
+  }
 
   void pop_back() {
     if (size_ > 0)
-      --size_;
+      destroy_from(size_ - 1);
   }
 
   void resize(size_t count, T value = T()) {
+    PHUNDRAK_PERF_SCOPE("vector::resize");
     if (count < size_)
-      size_ = count;
+      destroy_from(count);
     else if (count > size_)
-      reserve(count);
-    while (size_ < count)
-      push_back(value);
+      grow_to(count);
+    for (; size_ < count; ++size_)
+      alloc_traits::construct(alloc_, data_ + size_, value);
   }
 
-  void swap(vector<T> &other) {
+  //! resize(count, value), with the new elements constructed in parallel
+  //! as described in first_touch_assign().
+  void first_touch_resize(size_t count, const T &value = T(),
+                          unsigned threads = 0) {
+    PHUNDRAK_PERF_SCOPE("vector::first_touch_resize");
+    if (count <= size_)
+      destroy_from(count);
+    else
+      parallel_construct(count, value, threads);
+  }
+
+  void swap(vector &other) noexcept {
     std::swap(capacity_, other.capacity_);
     std::swap(size_, other.size_);
     std::swap(data_, other.data_);
+    std::swap(alloc_, other.alloc_);
   }
 
+  Allocator get_allocator() const { return alloc_; }
+
 protected:
 };
 